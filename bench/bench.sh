@@ -0,0 +1,95 @@
+#!/bin/sh
+# Emulator throughput benchmark.
+#
+# Runs every workload in this directory under each engine and prints one tab separated line per
+# workload and mode, best of the runs:
+#   workload  mode  cycles  seconds  mips  ns_per_cycle  rss_kib  result
+# Every mode has to reproduce the result and cycles of the first one, otherwise the script fails;
+# modes with -O only have to match the result, they run fewer cycles.
+#
+# Save the output as a baseline and pass it with -c on the next run to get the change in ns per
+# cycle; a slowdown above the threshold makes the script exit with 2.
+#
+# usage: bench/bench.sh [-n runs] [-m modes] [-c baseline.tsv] [-t percent] [interpret]
+#   -n  runs per workload and mode, default 3
+#   -m  space separated modes, "ref" for the plain interpreter, options joined by commas
+#       as in -j,-O, default "ref -f -j"
+#   -c  baseline to compare against
+#   -t  allowed slowdown in percent, default 10
+#   interpret defaults to bin/interpret next to this directory
+
+dir=$(cd "$(dirname "$0")" && pwd)
+runs=3
+modes="ref -f -j"
+baseline=
+threshold=10
+while getopts n:m:c:t: opt; do
+    case $opt in
+        n) runs=$OPTARG ;;
+        m) modes=$OPTARG ;;
+        c) baseline=$OPTARG ;;
+        t) threshold=$OPTARG ;;
+        *) exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+interpret=${1:-$dir/../bin/interpret}
+if [ ! -x "$interpret" ]; then
+    echo "No interpreter at $interpret" >&2
+    exit 1
+fi
+
+out=$(mktemp)
+err=$(mktemp)
+results=$(mktemp)
+trap 'rm -f "$out" "$err" "$results"' EXIT
+
+status=0
+printf '# workload\tmode\tcycles\tseconds\tmips\tns_per_cycle\trss_kib\tresult\n' | tee "$results"
+for file in "$dir"/*.txt; do
+    workload=$(basename "$file" .txt)
+    expect=
+    for mode in $modes; do
+        option=$(echo "$mode" | tr , ' ')
+        [ "$mode" = ref ] && option=
+        best=
+        for run in $(seq "$runs"); do
+            "$interpret" "$file" $option -T > "$out" 2> "$err" < /dev/null
+            timing=$(grep '^timing' "$err")
+            if [ -z "$timing" ]; then
+                echo "$workload $mode: no timing" >&2
+                cat "$err" >&2
+                exit 1
+            fi
+            seconds=$(echo "$timing" | cut -f3)
+            if [ -z "$best" ] || awk "BEGIN { exit !($seconds < $(echo "$best" | cut -f3)) }"; then
+                best=$timing
+            fi
+        done
+        result=$(grep -v '^cycles' "$out" | tr '\n' ' ' | sed 's/ $//')
+        cycles=$(echo "$best" | cut -f2)
+        if [ -z "$expect" ]; then
+            expect_cycles=$cycles
+            expect=$result
+        elif [ "$expect" != "$result" ] || { [ "$expect_cycles" != "$cycles" ] && ! echo "$option" | grep -q -- -O; }; then
+            echo "$workload $mode: got $result in $cycles cycles, expected $expect in $expect_cycles" >&2
+            status=1
+        fi
+        printf '%s\t%s\t%s\t%s\n' "$workload" "$mode" "$(echo "$best" | cut -f2-6)" "$result" | tee -a "$results"
+    done
+done
+
+if [ -n "$baseline" ]; then
+    awk -F '\t' -v limit="$threshold" '
+        FNR == NR { if($0 !~ /^#/) base[$1 "\t" $2] = $6; next }
+        /^#/ { printf "\n%-12s %-6s %12s %12s %8s\n", "workload", "mode", "base ns", "ns", "change" > "/dev/stderr"; next }
+        ($1 "\t" $2) in base {
+            change = ($6 - base[$1 "\t" $2]) * 100 / base[$1 "\t" $2]
+            slow = change > limit ? "  slower" : ""
+            printf "%-12s %-6s %12.3f %12.3f %+7.1f%%%s\n", $1, $2, base[$1 "\t" $2], $6, change, slow > "/dev/stderr"
+            if(slow != "") regressed = 1
+        }
+        END { exit regressed ? 2 : 0 }
+    ' "$baseline" "$results" || status=2
+fi
+exit $status
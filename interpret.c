@@ -2,6 +2,19 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "interpret.h"
 
 /*
 ISA
@@ -91,6 +104,7 @@ typedef struct breakpoint {
     uint16_t pc;
     int16_t flags;
     char *debug_msg;
+    uint16_t next; //1 + index of the next breakpoint at the same pc, 0 if last
 } breakpoint;
 
 typedef struct label {
@@ -98,41 +112,404 @@ typedef struct label {
     char *name;
 } label;
 
-typedef struct processor {
-    char memory[UINT16_MAX];
+//see DEVICES
+typedef struct watchpoint {
+    uint16_t addr, count;
+    uint8_t kinds;      //WATCH_READ, WATCH_WRITE and WATCH_CHANGE
+    char *debug_msg;    //as for breakpoints, 0 stops the run
+    int16_t *values;    //the watched words as lw and sw last saw them, for WATCH_CHANGE
+} watchpoint;
+
+//one pre-decoded instruction, indexed by PC
+typedef struct decoded {
+    uint8_t op;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    int16_t imm;
+    uint8_t inner; //real op behind a breakpoint
+    uint8_t pad;
+} decoded;
+
+typedef struct jit jit;
+typedef struct profile profile;
+typedef struct trace trace;
+typedef struct vcd vcd;
+typedef struct stream stream;
+typedef struct pipeline pipeline;
+typedef struct cache cache;
+typedef struct predictor predictor;
+typedef struct harts harts;
+typedef struct debugger debugger;
+
+//a memory mapped device on the word addresses base .. base + size - 1, see DEVICES
+typedef struct device {
+    uint16_t base, size;
+    int16_t (*read)(struct processor *p, uint16_t addr);             //value lw sees, 0 for plain memory
+    int (*write)(struct processor *p, uint16_t addr, int16_t value); //after the store, returns a stop reason
+} device;
+
+#define MAX_DEVICES 8
+
+//every 16 bit word address is backed, so wild stores cannot reach past the buffer
+#define MEMORY_SIZE 0x20000
+//stores mark 256 byte pages dirty, indexed by word address >> 7, so a reset only copies those back
+#define MEMORY_PAGES 512
+//io_pages flags
+#define PAGE_DEVICE 1
+#define PAGE_WATCH 2
+
+struct processor {
+    char *memory;               //MEMORY_SIZE bytes, code pages may be mapped from an object file
     int16_t registers[16];
     uint16_t PC;
     uint16_t instructions;
     uint16_t breakpoint_count;
     breakpoint *breakpoints;
-    uint16_t label_count;
-    uint16_t label_ref_count;
+    uint16_t *bp_index; //1 + index of the first breakpoint per pc >> 1, 0 if none
+    int label_count;
+    int label_ref_count;
     label *labels;
-    label *label_refs;
-} processor;
+    label *label_refs;          //fixups, resolved once the whole file is read
+    int *label_hash;            //open addressing table of 1 + label index, 0 if empty
+    int label_hash_size;        //power of 2, at least twice label_count
+    decoded *ops;
+    int ops_dirty;              //decoded slots may no longer match the loaded image
+    int64_t cycle;
+    FILE *out;                  //debug messages, 0 drops them
+    int16_t *inputs;            //values for the input port, 0 prompts on stdin
+    int input_count;
+    struct processor *parent;   //clones share the program tables of their parent
+    char *object;               //mapped object file the tables point into, 0 if assembled
+    size_t object_size;
+    profile *prof;              //filled in by interpret() when set
+    trace *trace;               //likewise
+    vcd *vcd;                   //likewise
+    pipeline *pipe;             //likewise
+    cache *icache, *dcache;     //likewise
+    predictor *bpred;           //likewise
+    jit *jit;                   //set while interpret_fast runs with one, so devices can invalidate it
+    stream *stream;             //input of the streaming console, see STREAM
+    device devices[MAX_DEVICES];
+    int device_count;
+    uint8_t io_pages[256];      //PAGE_ flags of 256 word pages with devices or watchpoints, only lw and sw look here
+    int64_t cycle_limit;        //runs stop with STOP_BUDGET on reaching this cycle, 0 for none
+    int stop_on_pause;          //pauses stop the run with STOP_BREAK instead of being skipped
+    int engine;                 //what processor_run uses, see LIBRARY
+    jit *run_jit;               //compiled code processor_run keeps between runs
+    uint8_t dirty[MEMORY_PAGES];    //pages stored to since the clone or the last reset
+    harts *harts;               //machine this hart belongs to, 0 outside -H, see HARTS
+    int hart;
+    int shared_memory;          //memory belongs to hart 0, so it is not unmapped with this one
+    uint16_t atomic_addr;       //per hart registers of the atomic device
+    int16_t atomic_old;
+    debugger *debug;            //set while -g runs the program, see DEBUGGER
+    watchpoint *watchpoints;    //clones get their own copies, the messages stay the parent's
+    int watch_count;
+    uint16_t watch_addr, watch_pc;  //last watchpoint hit
+    uint8_t watch_kind;
+};
+
+char *memory_new() {
+    char *m = mmap(0, MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return m == MAP_FAILED ? 0 : m;
+}
 
 processor *processor_new() {
     processor *p = calloc(1, sizeof(processor));
+    p->memory = memory_new();
     p->registers[1] = -1;
     p->registers[3] = 0x7FFF;
     p->breakpoints = malloc(4 * sizeof(breakpoint));
+    p->bp_index = calloc(0x8000, sizeof(uint16_t));
     p->labels = malloc(4 * sizeof(label));
     p->label_refs = malloc(4 * sizeof(label));
+    p->out = stdout;
+    void bus_attach_standard(processor *p);
+    bus_attach_standard(p);
+    return p;
+}
+
+//a processor to run the same program in; the program tables are shared, not copied
+processor *processor_clone(processor *p) {
+    processor *c = malloc(sizeof(processor));
+    memcpy(c, p, sizeof(processor));
+    c->memory = memory_new();
+    memcpy(c->memory, p->memory, MEMORY_SIZE);
+    c->object = 0;
+    c->jit = 0;
+    c->run_jit = 0;
+    memset(c->dirty, 0, sizeof(c->dirty));
+    c->ops = 0;
+    c->ops_dirty = 0;
+    c->parent = p->parent ? p->parent : p;
+    if(p->watch_count) {
+        c->watchpoints = malloc(p->watch_count * sizeof(watchpoint));
+        for(int i = 0; i < p->watch_count; i++) {
+            watchpoint *w = c->watchpoints + i;
+            *w = p->watchpoints[i];
+            w->values = malloc(w->count * sizeof(int16_t));
+            memcpy(w->values, p->watchpoints[i].values, w->count * sizeof(int16_t));
+        }
+    }
+    return c;
+}
+
+//watchpoints on changes compare against the words as they are now
+void watch_snapshot(processor *p) {
+    for(watchpoint *w = p->watchpoints; w < p->watchpoints + p->watch_count; w++)
+        memcpy(w->values, (int16_t*)p->memory + w->addr, w->count * sizeof(int16_t));
+}
+
+//puts a clone back into the state of the image it was cloned from, which must not have changed since
+void processor_reset(processor *p, processor *image) {
+    for(int i = 0; i < MEMORY_PAGES; i += 8) {
+        uint64_t any;
+        memcpy(&any, p->dirty + i, sizeof(any));
+        if(!any) continue;
+        for(int page = i; page < i + 8; page++) {
+            if(!p->dirty[page]) continue;
+            memcpy(p->memory + page * 256, image->memory + page * 256, 256);
+            //slots decoded from the page, including the one straddling its start, are stale; only the first 64 KB hold code
+            if(p->ops && page < 256) memset(p->ops + (page ? page * 256 - 1 : 0), 0, (page ? 257 : 256) * sizeof(decoded));
+        }
+    }
+    memset(p->dirty, 0, sizeof(p->dirty));
+    memcpy(p->registers, image->registers, sizeof(p->registers));
+    p->PC = image->PC;
+    p->cycle = 0;
+    watch_snapshot(p);
+    void jit_flush(jit *j);
+    if(p->run_jit && p->ops_dirty) jit_flush(p->run_jit);
+    p->ops_dirty = 0;
 }
 
 void processor_free(processor *p) {
+    void jit_free(jit *j);
+    void processor_free_msg(processor *p, char *msg);
+    jit_free(p->run_jit);
+    if(!p->shared_memory) munmap(p->memory, MEMORY_SIZE);
+    for(watchpoint *w = p->watchpoints; w < p->watchpoints + p->watch_count; w++) {
+        free(w->values);
+        processor_free_msg(p, w->debug_msg);
+    }
+    free(p->watchpoints);
+    if(p->parent) {
+        free(p->ops);
+        free(p);
+        return;
+    }
     free(p->breakpoints);
+    free(p->bp_index);
     free(p->label_refs);
     free(p->labels);
+    free(p->label_hash);
+    free(p->ops);
+    if(p->object) munmap(p->object, p->object_size);
     free(p);
 }
 
+//value read from the console input device
+int16_t processor_input(processor *p) {
+    int i = 0;
+    if(p->inputs) {
+        if(p->input_count <= 0) return 0;
+        p->input_count--;
+        return *p->inputs++;
+    }
+    printf("input: ");
+    fscanf(stdin, "%i", &i);
+    return i;
+}
+
+int processor_attach(processor *p, device d) {
+    if(p->device_count == MAX_DEVICES) return -1;
+    p->devices[p->device_count++] = d;
+    for(int a = d.base; a < d.base + d.size; a++) p->io_pages[(uint16_t)a >> 8] |= PAGE_DEVICE;
+    return 0;
+}
+
+//word a was written behind the back of the running engine
+void processor_stored(processor *p, uint16_t a) {
+    void jit_stored(jit *j, uint16_t addr);
+    p->dirty[a >> 7] = 1;
+    if(a < p->instructions) p->ops_dirty = 1;
+    if(p->ops && a < 0x8000) {
+        p->ops[2 * a].op = 0;
+        p->ops[2 * a + 1].op = 0;
+        if(a) p->ops[2 * a - 1].op = 0;
+    }
+    if(p->jit) jit_stored(p->jit, a);
+    if(p->run_jit && p->run_jit != p->jit) jit_stored(p->run_jit, a);
+}
+
 void processor_push_instr(processor *p, uint16_t instr) {
     *(uint16_t*)(p->memory + p->PC) = instr;
     p->PC += 2;
     p->instructions++;
 }
 
+//debug messages point into the object file when it was mapped, and belong to the parent of clones
+void processor_free_msg(processor *p, char *msg) {
+    if(!p->parent && (!p->object || msg < p->object || msg >= p->object + p->object_size)) free(msg);
+}
+
+//first breakpoint at pc, follow ->next for the rest
+breakpoint *processor_breakpoint(processor *p, uint16_t pc) {
+    int i = p->bp_index[pc >> 1];
+    while(i && p->breakpoints[i - 1].pc != pc) i = p->breakpoints[i - 1].next;
+    return i ? p->breakpoints + i - 1 : 0;
+}
+
+breakpoint *processor_next_breakpoint(processor *p, breakpoint *bp) {
+    int i = bp->next;
+    while(i && p->breakpoints[i - 1].pc != bp->pc) i = p->breakpoints[i - 1].next;
+    return i ? p->breakpoints + i - 1 : 0;
+}
+
+//whether one of the breakpoints at pc is a pause
+int processor_paused(processor *p, uint16_t pc) {
+    for(breakpoint *bp = processor_breakpoint(p, pc); bp; bp = processor_next_breakpoint(p, bp))
+        if(!bp->debug_msg) return 1;
+    return 0;
+}
+
+void processor_add_breakpoint(processor *p, uint16_t pc, char *debug_msg) {
+    if(p->breakpoint_count > 3 && !((p->breakpoint_count - 1) & p->breakpoint_count))
+        p->breakpoints = realloc(p->breakpoints, p->breakpoint_count * 2 * sizeof(breakpoint));
+    p->breakpoints[p->breakpoint_count++] = (breakpoint){ .pc = pc, .debug_msg = debug_msg };
+
+    //append to the chain so messages at one pc keep their source order
+    uint16_t *link = p->bp_index + (pc >> 1);
+    while(*link) link = &p->breakpoints[*link - 1].next;
+    *link = p->breakpoint_count;
+    if(p->ops) p->ops[pc].op = 0; //redecode so fast mode sees it
+}
+
+//removes every breakpoint at pc, returns how many were removed
+int processor_remove_breakpoints(processor *p, uint16_t pc) {
+    int removed = 0;
+    for(int i = 0; i < p->breakpoint_count; i++) {
+        if(p->breakpoints[i].pc == pc) {
+            processor_free_msg(p, p->breakpoints[i].debug_msg);
+            removed++;
+        } else {
+            p->breakpoints[i - removed] = p->breakpoints[i];
+        }
+    }
+    if(!removed) return 0;
+    p->breakpoint_count -= removed;
+    memset(p->bp_index, 0, 0x8000 * sizeof(uint16_t));
+    int count = p->breakpoint_count;
+    p->breakpoint_count = 0;
+    for(int i = 0; i < count; i++) {
+        breakpoint bp = p->breakpoints[i];
+        processor_add_breakpoint(p, bp.pc, bp.debug_msg);
+    }
+    if(p->ops) p->ops[pc].op = 0;
+    return removed;
+}
+
+uint32_t label_hash(char *name) {
+    uint32_t h = 2166136261u;
+    while(*name) h = (h ^ (uint8_t)*name++) * 16777619u;
+    return h;
+}
+
+label *processor_find_label(processor *p, char *name) {
+    if(!p->label_hash_size) return 0;
+    int mask = p->label_hash_size - 1;
+    for(int i = label_hash(name) & mask; p->label_hash[i]; i = (i + 1) & mask) {
+        label *l = p->labels + p->label_hash[i] - 1;
+        if(!strcmp(l->name, name)) return l;
+    }
+    return 0;
+}
+
+//takes ownership of name, returns -1 if the label already exists
+int processor_add_label(processor *p, uint16_t pc, char *name) {
+    if(processor_find_label(p, name)) return -1;
+    if(p->label_count > 3 && !((p->label_count - 1) & p->label_count))
+        p->labels = realloc(p->labels, p->label_count * 2 * sizeof(label));
+    p->labels[p->label_count++] = (label){ .pc = pc, .name = name };
+
+    if(p->label_count * 2 > p->label_hash_size) {
+        free(p->label_hash);
+        p->label_hash_size = p->label_hash_size ? p->label_hash_size * 2 : 64;
+        p->label_hash = calloc(p->label_hash_size, sizeof(int));
+        for(int l = 0; l < p->label_count; l++) {
+            int i = label_hash(p->labels[l].name) & (p->label_hash_size - 1);
+            while(p->label_hash[i]) i = (i + 1) & (p->label_hash_size - 1);
+            p->label_hash[i] = l + 1;
+        }
+    } else {
+        int i = label_hash(name) & (p->label_hash_size - 1);
+        while(p->label_hash[i]) i = (i + 1) & (p->label_hash_size - 1);
+        p->label_hash[i] = p->label_count;
+    }
+    return 0;
+}
+
+//patches every label reference, returns the number of errors
+int processor_resolve_labels(processor *p) {
+    int errors = 0;
+    for(int i = 0; i < p->label_ref_count; i++) {
+        label *ref = p->label_refs + i;
+        label *l = processor_find_label(p, ref->name);
+        if(!l) {
+            printf("Error: Undefined label %s at 0x%04X\n", ref->name, ref->pc);
+            errors++;
+            continue;
+        }
+        uint16_t *instr = (uint16_t*)(p->memory + ref->pc);
+        int imm = (*instr >> 12) == 14 ? l->pc - ref->pc : l->pc;
+        if(imm < -128 || imm > 127) {
+            printf("Error: Label %s is out of range [-128..127] at 0x%04X\n", ref->name, ref->pc);
+            errors++;
+            continue;
+        }
+        *instr = (*instr & 0xFF00) | (imm & 255);
+    }
+    return errors;
+}
+
+//assembler mnemonics are found by a perfect hash of the first two letters and the length
+#define MNEMONIC_HASH(c0, c1, len) (((c0) + 4 * (c1) + 5 * (len)) & 31)
+
+typedef struct mnemonic {
+    char *name;
+    char type;      //A, B or C instruction format, p for pause, d for debug, w for watch
+    int8_t opcode;
+} mnemonic;
+
+mnemonic mnemonics[32] = {
+    [MNEMONIC_HASH('p', 'a', 5)] = { "pause", 'p', -1 },
+    [MNEMONIC_HASH('d', 'e', 5)] = { "debug", 'd', -1 },
+    [MNEMONIC_HASH('w', 'a', 5)] = { "watch", 'w', -1 },
+    [MNEMONIC_HASH('a', 'd', 3)] = { "add",   'A', 0 },
+    [MNEMONIC_HASH('a', 'd', 4)] = { "addi",  'C', 1 },
+    [MNEMONIC_HASH('i', 'n', 3)] = { "inc",   'B', 2 },
+    [MNEMONIC_HASH('s', 'u', 3)] = { "sub",   'A', 3 },
+    [MNEMONIC_HASH('s', 'h', 3)] = { "shl",   'A', 4 },
+    [MNEMONIC_HASH('a', 'n', 3)] = { "and",   'A', 5 },
+    [MNEMONIC_HASH('o', 'r', 2)] = { "or",    'A', 6 },
+    [MNEMONIC_HASH('x', 'o', 3)] = { "xor",   'A', 7 },
+    [MNEMONIC_HASH('l', 'w', 2)] = { "lw",    'C', 8 },
+    [MNEMONIC_HASH('s', 'w', 2)] = { "sw",    'C', 9 },
+    [MNEMONIC_HASH('l', 'i', 2)] = { "li",    'B', 10 },
+    [MNEMONIC_HASH('l', 'u', 3)] = { "lui",   'B', 11 },
+    [MNEMONIC_HASH('e', 'q', 2)] = { "eq",    'A', 12 },
+    [MNEMONIC_HASH('l', 't', 2)] = { "lt",    'A', 13 },
+    [MNEMONIC_HASH('b', 'n', 3)] = { "bnz",   'B', 14 },
+    [MNEMONIC_HASH('j', 'a', 3)] = { "jal",   'C', 15 },
+};
+
+mnemonic *mnemonic_find(char *word, int len) {
+    if(len < 2 || len > 5) return 0;
+    mnemonic *m = mnemonics + MNEMONIC_HASH(word[0], word[1], len);
+    return m->name && !strncmp(m->name, word, len) && !m->name[len] ? m : 0;
+}
+
 int processor_load(processor *p, FILE *fp) {
     void skip_whitespace(char *buf, int *index);
     int parse_label(processor *p, char *buf);
@@ -141,6 +518,7 @@ int processor_load(processor *p, FILE *fp) {
     int parse_type_c(processor *p, int opcode, char *buf);
     int parse_debug(processor *p, char *buf);
     int parse_pause(processor *p, char *buf);
+    int parse_watch(processor *p, char *buf);
     char buf[512];
     int index, result, errors = 0;
     for(int line = 1; fgets(buf, 512, fp); line++) {
@@ -148,234 +526,4330 @@ int processor_load(processor *p, FILE *fp) {
         skip_whitespace(buf, &index);
         if(!strncmp("//", buf + index, 2)) continue; //skip comments
         if(buf[index] == 0) continue;
+        int len = 0;
+        while(buf[index + len] >= 'a' && buf[index + len] <= 'z') len++;
+        mnemonic *m = mnemonic_find(buf + index, len);
+        char *rest = buf + index + len;
         if(buf[index] == ':') result = parse_label(p, buf + index + 1);
-        else if(!strncmp("pause", buf + index, 5)) result = parse_pause(p, buf + index + 5);
-        else if(!strncmp("debug", buf + index, 5)) result = parse_debug(p, buf + index + 5);
-        else if(!strncmp("add",  buf + index, 3)) result = parse_type_a(p, 0,  buf + index + 3);
-        else if(!strncmp("addi", buf + index, 4)) result = parse_type_c(p, 1,  buf + index + 4);
-        else if(!strncmp("inc",  buf + index, 3)) result = parse_type_b(p, 2,  buf + index + 3);
-        else if(!strncmp("sub",  buf + index, 3)) result = parse_type_a(p, 3,  buf + index + 3);
-        else if(!strncmp("shl",  buf + index, 3)) result = parse_type_a(p, 4,  buf + index + 3);
-        else if(!strncmp("and",  buf + index, 3)) result = parse_type_a(p, 5,  buf + index + 3);
-        else if(!strncmp("or",   buf + index, 2)) result = parse_type_a(p, 6,  buf + index + 2);
-        else if(!strncmp("xor",  buf + index, 3)) result = parse_type_a(p, 7,  buf + index + 3);
-        else if(!strncmp("lw",   buf + index, 2)) result = parse_type_c(p, 8,  buf + index + 2);
-        else if(!strncmp("sw",   buf + index, 2)) result = parse_type_c(p, 9,  buf + index + 2);
-        else if(!strncmp("li",   buf + index, 2)) result = parse_type_b(p, 10, buf + index + 2);
-        else if(!strncmp("lui",  buf + index, 3)) result = parse_type_b(p, 11, buf + index + 3);
-        else if(!strncmp("eq",   buf + index, 2)) result = parse_type_a(p, 12, buf + index + 2);
-        else if(!strncmp("lt",   buf + index, 2)) result = parse_type_a(p, 13, buf + index + 2);
-        else if(!strncmp("bnz",  buf + index, 3)) result = parse_type_b(p, 14, buf + index + 3);
-        else if(!strncmp("jal",  buf + index, 3)) result = parse_type_c(p, 15, buf + index + 3);
-        else {
+        else if(!m) {
             result = -1;
             printf("Unrecognized command at [%s]\n", buf + index);
         }
+        else if(m->type == 'p') result = parse_pause(p, rest);
+        else if(m->type == 'd') result = parse_debug(p, rest);
+        else if(m->type == 'w') result = parse_watch(p, rest);
+        else if(m->type == 'A') result = parse_type_a(p, m->opcode, rest);
+        else if(m->type == 'B') result = parse_type_b(p, m->opcode, rest);
+        else result = parse_type_c(p, m->opcode, rest);
         if(result < 0) {
             buf[strlen(buf) - 1] = 0;
             printf(" line %d\n       [%s]\n", line, buf);
             errors++;
         }
     }
-    return errors;
+    errors += processor_resolve_labels(p);
+    p->PC = 0;
+    watch_snapshot(p);
+    return errors;
+}
+#pragma endregion
+
+//PROFILER
+#pragma region
+
+/*
+Counts executions per PC and taken branches per bnz, and keeps a call tree. jal ra calls the
+target, jal x0, ra+0 returns, other jumps stay in the current function. A function is named by
+the label at its entry. Every cycle is charged to the current call tree node. Functions get
+exclusive cycles (their own nodes) and inclusive cycles (their subtrees, counted once under
+recursion). Nodes print as folded stacks for flamegraph tools.
+*/
+
+#define PROFILE_TOP 20
+
+typedef struct profile_node {
+    uint16_t func;      //entry pc
+    int parent;         //-1 for the root
+    int child, sibling; //first child and next sibling, -1 if none
+    int64_t calls;
+    int64_t self;
+} profile_node;
+
+struct profile {
+    int64_t counts[0x8000];     //per pc >> 1
+    int64_t taken[0x8000];
+    profile_node *nodes;
+    int node_count;
+    int node_capacity;
+    int current;
+    int64_t cycles;
+};
+
+int profile_node_new(profile *pr, int parent, uint16_t func) {
+    if(pr->node_count == pr->node_capacity) {
+        pr->node_capacity = pr->node_capacity ? pr->node_capacity * 2 : 64;
+        pr->nodes = realloc(pr->nodes, pr->node_capacity * sizeof(profile_node));
+    }
+    profile_node *n = pr->nodes + pr->node_count;
+    *n = (profile_node){ .func = func, .parent = parent, .child = -1, .sibling = -1 };
+    if(parent >= 0) {
+        n->sibling = pr->nodes[parent].child;
+        pr->nodes[parent].child = pr->node_count;
+    }
+    return pr->node_count++;
+}
+
+profile *profile_new(uint16_t entry) {
+    profile *pr = calloc(1, sizeof(profile));
+    pr->current = profile_node_new(pr, -1, entry);
+    pr->nodes[0].calls = 1;
+    return pr;
+}
+
+void profile_free(profile *pr) {
+    if(!pr) return;
+    free(pr->nodes);
+    free(pr);
+}
+
+//records one executed instruction, taken is set for a taken bnz
+void profile_step(profile *pr, uint16_t pc, uint16_t instr, int taken, uint16_t next_pc) {
+    pr->counts[pc >> 1]++;
+    pr->nodes[pr->current].self++;
+    pr->cycles++;
+    int opcode = instr >> 12, rd = (instr >> 8) & 15, rs1 = (instr >> 4) & 15, imm = instr & 15;
+    if(opcode == 14) {
+        pr->taken[pc >> 1] += taken;
+    } else if(opcode == 15 && rd == 2) {
+        int n = pr->nodes[pr->current].child;
+        while(n >= 0 && pr->nodes[n].func != next_pc) n = pr->nodes[n].sibling;
+        if(n < 0) n = profile_node_new(pr, pr->current, next_pc);
+        pr->nodes[n].calls++;
+        pr->current = n;
+    } else if(opcode == 15 && rd == 0 && rs1 == 2 && imm == 0 && pr->nodes[pr->current].parent >= 0) {
+        pr->current = pr->nodes[pr->current].parent;
+    }
+}
+
+//label at pc, or the nearest label before it with the offset appended
+char *profile_name(processor *p, uint16_t pc, int exact, char *buf, int size) {
+    label *best = 0;
+    for(int i = 0; i < p->label_count; i++)
+        if(p->labels[i].pc <= pc && (!best || p->labels[i].pc > best->pc)) best = p->labels + i;
+    if(best && best->pc == pc) snprintf(buf, size, "%s", best->name);
+    else if(best && !exact) snprintf(buf, size, "%s+%d", best->name, pc - best->pc);
+    else snprintf(buf, size, "0x%04X", pc);
+    return buf;
+}
+
+int64_t profile_subtree(profile *pr, int n) {
+    int64_t total = pr->nodes[n].self;
+    for(int c = pr->nodes[n].child; c >= 0; c = pr->nodes[c].sibling) total += profile_subtree(pr, c);
+    return total;
+}
+
+int profile_compare(const void *a, const void *b) {
+    int64_t x = ((int64_t*)a)[0], y = ((int64_t*)b)[0];
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void profile_report(profile *pr, processor *p, FILE *fp) {
+    void fprint_instruction(FILE *fp, uint16_t instr);
+    char name[300];
+    double total = pr->cycles ? pr->cycles : 1;
+
+    //count, pc pairs sorted by count
+    int64_t (*hot)[2] = malloc(0x8000 * sizeof(*hot));
+    int hot_count = 0;
+    for(int i = 0; i < 0x8000; i++)
+        if(pr->counts[i]) { hot[hot_count][0] = pr->counts[i]; hot[hot_count++][1] = i * 2; }
+    qsort(hot, hot_count, sizeof(*hot), profile_compare);
+
+    fprintf(fp, "\nprofile: %lld cycles\n\n", (long long)pr->cycles);
+    fprintf(fp, "addr   | instruction       | count        |      %% | location             | taken / not taken\n");
+    for(int i = 0; i < hot_count && i < PROFILE_TOP; i++) {
+        uint16_t pc = hot[i][1];
+        uint16_t instr = *(uint16_t*)(p->memory + pc);
+        fprintf(fp, "0x%04X | ", pc);
+        fprint_instruction(fp, instr);
+        fprintf(fp, " | %12lld | %6.2f | %-20s |", (long long)hot[i][0], hot[i][0] * 100 / total, profile_name(p, pc, 0, name, 300));
+        if(instr >> 12 == 14)
+            fprintf(fp, " %lld / %lld", (long long)pr->taken[pc >> 1], (long long)(hot[i][0] - pr->taken[pc >> 1]));
+        fprintf(fp, "\n");
+    }
+
+    //inclusive time only counts nodes without an ancestor running the same function
+    uint16_t *func = malloc(pr->node_count * sizeof(uint16_t));
+    int64_t (*stats)[3] = calloc(pr->node_count, sizeof(*stats)); //inclusive, exclusive, calls
+    int funcs = 0;
+    for(int n = 0; n < pr->node_count; n++) {
+        int f = 0;
+        while(f < funcs && func[f] != pr->nodes[n].func) f++;
+        if(f == funcs) func[funcs++] = pr->nodes[n].func;
+        stats[f][1] += pr->nodes[n].self;
+        stats[f][2] += pr->nodes[n].calls;
+        int a = pr->nodes[n].parent;
+        while(a >= 0 && pr->nodes[a].func != pr->nodes[n].func) a = pr->nodes[a].parent;
+        if(a < 0) stats[f][0] += profile_subtree(pr, n);
+    }
+    int64_t (*order)[2] = malloc(funcs * sizeof(*order));
+    for(int f = 0; f < funcs; f++) { order[f][0] = stats[f][0]; order[f][1] = f; }
+    qsort(order, funcs, sizeof(*order), profile_compare);
+
+    fprintf(fp, "\nfunction             | calls        | inclusive    |      %% | exclusive    |      %%\n");
+    for(int i = 0; i < funcs; i++) {
+        int f = order[i][1];
+        fprintf(fp, "%-20s | %12lld | %12lld | %6.2f | %12lld | %6.2f\n", profile_name(p, func[f], 1, name, 300),
+            (long long)stats[f][2], (long long)stats[f][0], stats[f][0] * 100 / total, (long long)stats[f][1], stats[f][1] * 100 / total);
+    }
+    free(order);
+    free(stats);
+    free(func);
+    free(hot);
+}
+
+//one "root;caller;callee cycles" line per call tree node with cycles of its own
+void profile_folded(profile *pr, processor *p, FILE *fp) {
+    char name[300];
+    int *path = malloc(pr->node_count * sizeof(int));
+    for(int n = 0; n < pr->node_count; n++) {
+        if(!pr->nodes[n].self) continue;
+        int depth = 0;
+        for(int a = n; a >= 0; a = pr->nodes[a].parent) path[depth++] = a;
+        while(depth--) fprintf(fp, "%s%c", profile_name(p, pr->nodes[path[depth]].func, 1, name, 300), depth ? ';' : ' ');
+        fprintf(fp, "%lld\n", (long long)pr->nodes[n].self);
+    }
+    free(path);
+}
+
+#pragma endregion
+
+//TRACE
+#pragma region
+
+/*
+Binary execution trace. interpret() appends one 8 byte record per instruction to a ring buffer
+that keeps the last TRACE_RECORDS; trace_save writes them out and trace_decode turns a saved trace
+back into the -d listing. The instruction says what the value is: the register written, or for
+sw the word stored at addr.
+*/
+
+#define TRACE_MAGIC "ITRC"
+#define TRACE_RECORDS (1 << 20)
+
+typedef struct trace_record {
+    uint16_t pc;
+    uint16_t instr;
+    int16_t value;
+    uint16_t addr;
+} trace_record;
+
+struct trace {
+    trace_record *ring;
+    uint64_t count;     //records ever written, the ring holds the last TRACE_RECORDS
+};
+
+typedef struct trace_header {
+    char magic[4];
+    uint32_t records;   //in this file
+    uint64_t count;     //executed, the first count - records were dropped
+} trace_header;
+
+trace *trace_new() {
+    trace *t = malloc(sizeof(trace));
+    t->ring = malloc(TRACE_RECORDS * sizeof(trace_record));
+    t->count = 0;
+    return t;
+}
+
+void trace_free(trace *t) {
+    if(!t) return;
+    free(t->ring);
+    free(t);
+}
+
+static inline void trace_step(trace *t, uint16_t pc, uint16_t instr, int16_t value, uint16_t addr) {
+    t->ring[t->count++ & (TRACE_RECORDS - 1)] = (trace_record){ pc, instr, value, addr };
+}
+
+void trace_save(trace *t, FILE *fp) {
+    trace_header h = { .magic = TRACE_MAGIC, .count = t->count };
+    h.records = t->count < TRACE_RECORDS ? t->count : TRACE_RECORDS;
+    fwrite(&h, sizeof(h), 1, fp);
+    uint32_t start = (t->count - h.records) & (TRACE_RECORDS - 1);
+    uint32_t first = TRACE_RECORDS - start < h.records ? TRACE_RECORDS - start : h.records;
+    fwrite(t->ring + start, sizeof(trace_record), first, fp);
+    fwrite(t->ring, sizeof(trace_record), h.records - first, fp);
+}
+
+int trace_is(FILE *fp) {
+    char magic[4] = { 0 };
+    int n = fread(magic, 1, 4, fp);
+    rewind(fp);
+    return n == 4 && !memcmp(magic, TRACE_MAGIC, 4);
+}
+
+//prints a saved trace like the -d listing, with the value each instruction wrote
+int trace_decode(FILE *in, FILE *out) {
+    void fprint_instruction(FILE *fp, uint16_t instr);
+    int sprintreg(char *buf, int n);
+    trace_header h;
+    if(fread(&h, sizeof(h), 1, in) != 1) {
+        printf("Malformed trace file\n");
+        return -1;
+    }
+    if(h.records < h.count) fprintf(out, "(%llu earlier instructions not kept)\n", (unsigned long long)(h.count - h.records));
+    fprintf(out, "addr   | instruction       | writes\n");
+    trace_record r;
+    for(uint32_t i = 0; i < h.records && fread(&r, sizeof(r), 1, in) == 1; i++) {
+        int opcode = r.instr >> 12, rd = (r.instr >> 8) & 15;
+        fprintf(out, "0x%04X | ", r.pc);
+        fprint_instruction(out, r.instr);
+        if(opcode == 9) {
+            fprintf(out, " | mem[0x%04X] = %i", r.addr, r.value);
+        } else if(opcode != 14 && rd > 1) {
+            char name[4];
+            sprintreg(name, rd);
+            fprintf(out, " | %s = %i", name, r.value);
+        }
+        fprintf(out, "\n");
+    }
+    return 0;
+}
+
+#pragma endregion
+
+//VCD
+#pragma region
+
+/*
+-w <signals> streams a VCD waveform of the datapath signals interpret() computes to <file>.vcd, to
+compare against an RTL simulation in a waveform viewer or by script. Signals are a comma separated
+list of pc, instr, alu_op, alu_out, mem_out, mux2_out, not_zero, next_pc and register names, or regs
+for the whole register file, or all. Time is the cycle number; each instruction's signals are
+sampled after its write back, and mem_out holds the last lw's value in between. Only value changes
+are written, with leading zeros dropped, into a VCD_BUFFER sized buffer that is written out when it
+fills, so a multi-million cycle run costs a few bytes per changed signal and one write per buffer.
+*/
+
+#define VCD_BUFFER (1 << 20)
+#define VCD_RECORD 24   //longest value change: b, 16 bits, space, id, newline, or a timestamp
+
+enum { VCD_PC, VCD_INSTR, VCD_ALU_OP, VCD_ALU_OUT, VCD_MEM_OUT, VCD_MUX2_OUT, VCD_NOT_ZERO, VCD_NEXT_PC, VCD_REGS, VCD_SIGNALS = VCD_REGS + 16 };
+
+char *vcd_names[VCD_REGS] = { "pc", "instr", "alu_op", "alu_out", "mem_out", "mux2_out", "not_zero", "next_pc" };
+uint8_t vcd_widths[VCD_REGS] = { 16, 16, 4, 16, 16, 16, 1, 16 };
+
+struct vcd {
+    FILE *fp;
+    char *buf;
+    int used;
+    uint8_t selected[VCD_SIGNALS];
+    uint8_t list[VCD_SIGNALS];      //the selected signals, count of them
+    int count;
+    uint16_t now[VCD_SIGNALS];      //this cycle's values
+    uint16_t last[VCD_SIGNALS];     //as last written
+    int64_t time;                   //of the last timestamp written, -1 before the first
+};
+
+//signals from a -w spec, 0 with a message if it names something unknown or path cannot be written
+vcd *vcd_new(char *spec, char *path) {
+    int sprintreg(char *buf, int n);
+    uint8_t selected[VCD_SIGNALS] = { 0 };
+    char name[16];
+    int n;
+    while(*spec) {
+        if(sscanf(spec, "%15[^,]%n", name, &n) != 1) {
+            printf("Malformed signal list at [%s]\n", spec);
+            return 0;
+        }
+        spec += n + (spec[n] == ',');
+        int found = 0;
+        for(int i = 0; i < VCD_SIGNALS; i++) {
+            char reg[4];
+            if(i >= VCD_REGS) sprintreg(reg, i - VCD_REGS);
+            if(!strcmp(name, "all") || (!strcmp(name, "regs") && i >= VCD_REGS)
+                || !strcmp(name, i < VCD_REGS ? vcd_names[i] : reg)) selected[i] = found = 1;
+        }
+        if(!found) {
+            printf("Unknown signal %s\n", name);
+            return 0;
+        }
+    }
+    FILE *fp = fopen(path, "w");
+    if(!fp) {
+        printf("Cannot write %s\n", path);
+        return 0;
+    }
+    vcd *v = calloc(1, sizeof(vcd));
+    v->fp = fp;
+    v->buf = malloc(VCD_BUFFER);
+    v->time = -1;
+    memcpy(v->selected, selected, sizeof(selected));
+    for(int i = 0; i < VCD_SIGNALS; i++) if(selected[i]) v->list[v->count++] = i;
+
+    //identifiers are one printable character per signal
+    fprintf(fp, "$version interpret $end\n$timescale 1ns $end\n$scope module cpu $end\n");
+    for(int i = 0; i < VCD_REGS; i++)
+        if(selected[i]) fprintf(fp, "$var wire %d %c %s $end\n", vcd_widths[i], '!' + i, vcd_names[i]);
+    if(memchr(selected + VCD_REGS, 1, 16)) {
+        fprintf(fp, "$scope module regs $end\n");
+        for(int i = VCD_REGS; i < VCD_SIGNALS; i++) {
+            char reg[4];
+            sprintreg(reg, i - VCD_REGS);
+            if(selected[i]) fprintf(fp, "$var reg 16 %c %s $end\n", '!' + i, reg);
+        }
+        fprintf(fp, "$upscope $end\n");
+    }
+    fprintf(fp, "$upscope $end\n$enddefinitions $end\n");
+    return v;
+}
+
+static const char vcd_nibbles[16][4] = {
+    "0000", "0001", "0010", "0011", "0100", "0101", "0110", "0111",
+    "1000", "1001", "1010", "1011", "1100", "1101", "1110", "1111"
+};
+
+//#cycle and a newline, sprintf is most of the cost of a sparse waveform
+static inline char *vcd_time(char *out, int64_t cycle) {
+    char digits[20];
+    int n = 0;
+    do digits[n++] = '0' + cycle % 10; while(cycle /= 10);
+    *out++ = '#';
+    while(n) *out++ = digits[--n];
+    *out++ = '\n';
+    return out;
+}
+
+void vcd_flush(vcd *v) {
+    fwrite(v->buf, 1, v->used, v->fp);
+    v->used = 0;
+}
+
+static inline void vcd_step(vcd *v, int64_t cycle, uint16_t pc, uint16_t instr, int ALU_op, int16_t ALU_out, int mem_read,
+    int16_t mem_out, int16_t mux2_out, int not_zero, uint16_t next_PC, int16_t *registers) {
+    uint16_t *now = v->now;
+    now[VCD_PC] = pc;
+    now[VCD_INSTR] = instr;
+    now[VCD_ALU_OP] = ALU_op;
+    now[VCD_ALU_OUT] = ALU_out;
+    if(mem_read) now[VCD_MEM_OUT] = mem_out;
+    now[VCD_MUX2_OUT] = mux2_out;
+    now[VCD_NOT_ZERO] = not_zero;
+    now[VCD_NEXT_PC] = next_PC;
+    memcpy(now + VCD_REGS, registers, 16 * sizeof(int16_t));
+
+    if(v->used > VCD_BUFFER - VCD_RECORD * (VCD_SIGNALS + 1)) vcd_flush(v);
+    char *out = v->buf + v->used;
+    int first = v->time < 0, timed = 0;
+    for(int k = 0; k < v->count; k++) {
+        int i = v->list[k];
+        if(now[i] == v->last[i] && !first) continue;
+        if(!timed) {
+            out = vcd_time(out, cycle);
+            timed = 1;
+        }
+        v->last[i] = now[i];
+        if(i == VCD_NOT_ZERO) *out++ = '0' + now[i];
+        else {
+            //all 16 digits a nibble at a time, then only from the highest one bit on
+            char digits[16];
+            for(int n = 0; n < 4; n++) memcpy(digits + 4 * n, vcd_nibbles[(now[i] >> (12 - 4 * n)) & 15], 4);
+            int len = now[i] ? 32 - __builtin_clz(now[i]) : 1;
+            *out++ = 'b';
+            memcpy(out, digits + 16 - len, len);
+            out += len;
+            *out++ = ' ';
+        }
+        *out++ = '!' + i;
+        *out++ = '\n';
+    }
+    if(timed) v->time = cycle;
+    v->used = out - v->buf;
+}
+
+//ends the waveform at cycle, or past the last sample for runs stopped by an sw, and closes the file
+void vcd_close(vcd *v, int64_t cycle) {
+    if(!v) return;
+    v->used = vcd_time(v->buf + v->used, cycle > v->time ? cycle : v->time + 1) - v->buf;
+    vcd_flush(v);
+    fclose(v->fp);
+    free(v->buf);
+    free(v);
+}
+
+#pragma endregion
+
+//PIPELINE
+#pragma region
+
+/*
+Timing model of a classic in-order IF/ID/EX/MEM/WB pipeline running the same instruction stream as
+interpret(). Only timing is modelled: each instruction gets the cycle it spends in EX. Operands come
+from the register file in ID, which sees WB's write of the same cycle, or with forwarding from the
+EX/MEM and MEM/WB latches into EX (and into MEM for sw data). A consumer is held in ID until its
+operands can reach it. bnz and jal resolve in EX with fetch predicting fall-through, so a taken bnz
+and every jal flush the two instructions behind them.
+*/
+
+#define PIPELINE_TOP 20
+#define PIPELINE_FLUSH 2
+
+typedef struct pipeline_pc {
+    int64_t load_use;   //stall cycles waiting on a load
+    int64_t data;       //stall cycles waiting on an ALU result, only without forwarding
+    int64_t flush;      //bubbles after this instruction redirected fetch
+    int64_t forwards;   //operands that arrived through a forwarding path
+} pipeline_pc;
+
+struct pipeline {
+    int forwarding;
+    int64_t ex;             //EX cycle of the last instruction
+    int64_t next;           //earliest EX cycle of the next instruction
+    int64_t ready[16];      //earliest EX cycle that can use the register
+    int64_t store_ready[16];//same for sw data, which is needed a stage later
+    int64_t written[16];    //cycle the register file has the value
+    uint8_t loaded[16];     //last writer was a load
+    int64_t instructions;
+    pipeline_pc total;
+    pipeline_pc pcs[0x8000];
+};
+
+pipeline *pipeline_new(int forwarding) {
+    pipeline *pl = calloc(1, sizeof(pipeline));
+    pl->forwarding = forwarding;
+    pl->ex = 2;
+    pl->next = 3;
+    return pl;
+}
+
+void pipeline_free(pipeline *pl) {
+    free(pl);
+}
+
+//one executed instruction, taken is set for a taken bnz
+void pipeline_step(pipeline *pl, uint16_t pc, uint16_t instr, int taken) {
+    int opcode = instr >> 12, rd = (instr >> 8) & 15, rs1 = (instr >> 4) & 15, rs2 = instr & 15;
+    pipeline_pc *at = pl->pcs + (pc >> 1);
+
+    //registers read in EX, and the one sw needs in MEM
+    int reads[2], count = 0, store = -1;
+    switch(opcode) {
+        case 1: case 8: case 15: reads[count++] = rs1; break;
+        case 2: case 14:         reads[count++] = rd; break;
+        case 9:                  reads[count++] = rs1; store = rd; break;
+        case 10: case 11:        break;
+        default:                 reads[count++] = rs1; reads[count++] = rs2; break;
+    }
+
+    int64_t ex = pl->next;
+    int load = 0;
+    for(int i = 0; i <= count; i++) {
+        int r = i < count ? reads[i] : store;
+        if(r <= 1) continue;
+        int64_t ready = i < count ? pl->ready[r] : pl->store_ready[r];
+        if(ready > ex) {
+            ex = ready;
+            load = pl->loaded[r];
+        }
+    }
+    int64_t stall = ex - pl->next;
+    if(stall && load && pl->forwarding) {
+        at->load_use += stall;
+        pl->total.load_use += stall;
+    } else if(stall) {
+        at->data += stall;
+        pl->total.data += stall;
+    }
+
+    //operands the register file did not have yet when this instruction left ID
+    for(int i = 0; i <= count && pl->forwarding; i++) {
+        int r = i < count ? reads[i] : store;
+        if(r > 1 && pl->written[r] > ex - 1) {
+            at->forwards++;
+            pl->total.forwards++;
+        }
+    }
+
+    //results: ALU in EX, loads in MEM, everything in the register file after WB
+    if(opcode != 9 && opcode != 14 && rd > 1) {
+        int is_load = opcode == 8;
+        pl->written[rd] = ex + 2;
+        pl->loaded[rd] = is_load;
+        if(pl->forwarding) {
+            pl->ready[rd] = ex + 1 + is_load;
+            pl->store_ready[rd] = ex + is_load;
+        } else {
+            pl->ready[rd] = pl->store_ready[rd] = ex + 3;
+        }
+    }
+
+    pl->ex = ex;
+    pl->next = ex + 1;
+    if((opcode == 14 && taken) || opcode == 15) {
+        pl->next += PIPELINE_FLUSH;
+        at->flush += PIPELINE_FLUSH;
+        pl->total.flush += PIPELINE_FLUSH;
+    }
+    pl->instructions++;
+}
+
+int pipeline_compare(const void *a, const void *b) {
+    int64_t x = ((int64_t*)a)[0], y = ((int64_t*)b)[0];
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void pipeline_report(pipeline *pl, processor *p, FILE *fp) {
+    void fprint_instruction(FILE *fp, uint16_t instr);
+    //the last instruction still goes through MEM and WB
+    int64_t cycles = pl->instructions ? pl->ex + 2 : 0;
+    pipeline_pc *t = &pl->total;
+    double total = cycles ? cycles : 1;
+
+    fprintf(fp, "\npipeline: 5 stages, forwarding %s\n", pl->forwarding ? "on" : "off");
+    fprintf(fp, "instructions: %lld\ncycles: %lld\nCPI: %.3f\n", (long long)pl->instructions, (long long)cycles,
+        pl->instructions ? cycles / (double)pl->instructions : 0);
+    fprintf(fp, "load-use stalls: %12lld (%6.2f%%)\n", (long long)t->load_use, t->load_use * 100 / total);
+    fprintf(fp, "data stalls:     %12lld (%6.2f%%)\n", (long long)t->data, t->data * 100 / total);
+    fprintf(fp, "flush bubbles:   %12lld (%6.2f%%)\n", (long long)t->flush, t->flush * 100 / total);
+    fprintf(fp, "forwarded operands: %lld\n", (long long)t->forwards);
+
+    //lost cycles, pc pairs sorted by lost cycles
+    int64_t (*lost)[2] = malloc(0x8000 * sizeof(*lost));
+    int count = 0;
+    for(int i = 0; i < 0x8000; i++) {
+        pipeline_pc *at = pl->pcs + i;
+        if(!at->load_use && !at->data && !at->flush && !at->forwards) continue;
+        lost[count][0] = at->load_use + at->data + at->flush;
+        lost[count++][1] = i;
+    }
+    qsort(lost, count, sizeof(*lost), pipeline_compare);
+
+    fprintf(fp, "\naddr   | instruction       | load-use     | data         | flush        | forwards\n");
+    for(int i = 0; i < count && i < PIPELINE_TOP; i++) {
+        pipeline_pc *at = pl->pcs + lost[i][1];
+        fprintf(fp, "0x%04X | ", (int)lost[i][1] * 2);
+        fprint_instruction(fp, ((uint16_t*)p->memory)[lost[i][1]]);
+        fprintf(fp, " | %12lld | %12lld | %12lld | %lld\n", (long long)at->load_use, (long long)at->data,
+            (long long)at->flush, (long long)at->forwards);
+    }
+    free(lost);
+}
+
+#pragma endregion
+
+//CACHE
+#pragma region
+
+/*
+Set associative cache model for instruction fetch and data accesses in interpret(). Only tags are
+kept; memory stays the source of the data. Write-back caches allocate on a write miss and write
+dirty lines back on eviction, write-through caches send every store to memory and do not allocate.
+Device accesses bypass the data cache. Every miss, writeback and write-through store is charged the
+miss penalty on top of the cycle count.
+
+Spec: comma separated key=value, e.g. size=512,assoc=2,line=16,replace=lru,write=back,penalty=10
+*/
+
+#define CACHE_TOP 10
+
+enum { CACHE_LRU, CACHE_FIFO, CACHE_RANDOM };
+
+typedef struct cache_line {
+    uint32_t tag;
+    uint8_t valid, dirty;
+    int64_t stamp;      //last use for LRU, fill for FIFO
+} cache_line;
+
+struct cache {
+    char *name;
+    int data;           //lines are reported as word addresses
+    int size, assoc, line, sets;
+    int replace, write_back, penalty;
+    cache_line *lines;  //sets * assoc
+    int64_t tick;
+    uint32_t seed;
+    int64_t reads, writes, read_misses, write_misses, writebacks;
+    uint32_t *misses;   //per line of the 128K address space
+};
+
+cache *cache_new(char *name, char *spec, int data) {
+    cache *c = calloc(1, sizeof(cache));
+    *c = (cache){ .name = name, .data = data, .size = 1024, .assoc = 2, .line = 16, .write_back = 1, .penalty = 10, .seed = 1 };
+    char key[16], value[16];
+    int n;
+    while(*spec) {
+        if(sscanf(spec, "%15[^=]=%15[^,]%n", key, value, &n) != 2) {
+            printf("Malformed cache spec at [%s]\n", spec);
+            free(c);
+            return 0;
+        }
+        spec += n + (spec[n] == ',');
+        if(!strcmp(key, "size")) c->size = atoi(value);
+        else if(!strcmp(key, "assoc")) c->assoc = atoi(value);
+        else if(!strcmp(key, "line")) c->line = atoi(value);
+        else if(!strcmp(key, "penalty")) c->penalty = atoi(value);
+        else if(!strcmp(key, "replace") && !strcmp(value, "lru")) c->replace = CACHE_LRU;
+        else if(!strcmp(key, "replace") && !strcmp(value, "fifo")) c->replace = CACHE_FIFO;
+        else if(!strcmp(key, "replace") && !strcmp(value, "random")) c->replace = CACHE_RANDOM;
+        else if(!strcmp(key, "write") && !strcmp(value, "back")) c->write_back = 1;
+        else if(!strcmp(key, "write") && !strcmp(value, "through")) c->write_back = 0;
+        else {
+            printf("Unknown cache setting %s=%s\n", key, value);
+            free(c);
+            return 0;
+        }
+    }
+    c->sets = c->assoc > 0 && c->line > 0 ? c->size / (c->assoc * c->line) : 0;
+    if(c->sets < 1 || (c->sets & (c->sets - 1)) || (c->line & (c->line - 1)) || c->sets * c->assoc * c->line != c->size || c->line < 2) {
+        printf("Cache %s: size must be assoc * line * sets with line and sets powers of 2\n", name);
+        free(c);
+        return 0;
+    }
+    c->lines = calloc(c->sets * c->assoc, sizeof(cache_line));
+    c->misses = calloc(MEMORY_SIZE / c->line, sizeof(uint32_t));
+    return c;
+}
+
+void cache_free(cache *c) {
+    if(!c) return;
+    free(c->lines);
+    free(c->misses);
+    free(c);
+}
+
+//byte address addr is read or written
+void cache_access(cache *c, uint32_t addr, int write) {
+    uint32_t block = addr / c->line;
+    cache_line *set = c->lines + (block & (c->sets - 1)) * c->assoc;
+    uint32_t tag = block / c->sets;
+    c->tick++;
+    if(write) c->writes++;
+    else c->reads++;
+
+    for(int i = 0; i < c->assoc; i++) {
+        if(!set[i].valid || set[i].tag != tag) continue;
+        if(c->replace == CACHE_LRU) set[i].stamp = c->tick;
+        if(write && c->write_back) set[i].dirty = 1;
+        return;
+    }
+
+    if(write) c->write_misses++;
+    else c->read_misses++;
+    c->misses[block]++;
+    if(write && !c->write_back) return;
+
+    cache_line *victim = set;
+    for(int i = 0; i < c->assoc && victim->valid; i++)
+        if(!set[i].valid || set[i].stamp < victim->stamp) victim = set + i;
+    if(victim->valid && c->replace == CACHE_RANDOM) {
+        c->seed = c->seed * 1103515245 + 12345;
+        victim = set + (c->seed >> 16) % c->assoc;
+    }
+    if(victim->valid && victim->dirty) c->writebacks++;
+    *victim = (cache_line){ .tag = tag, .valid = 1, .dirty = write, .stamp = c->tick };
+}
+
+//cycles the cache adds on top of a single cycle memory
+int64_t cache_cost(cache *c) {
+    if(!c) return 0;
+    int64_t transfers = c->read_misses + c->write_misses + c->writebacks;
+    if(!c->write_back) transfers = c->read_misses + c->writes;
+    return transfers * c->penalty;
+}
+
+int cache_compare(const void *a, const void *b) {
+    int64_t x = ((int64_t*)a)[0], y = ((int64_t*)b)[0];
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void cache_report(cache *c, FILE *fp) {
+    static char *replace[] = { "lru", "fifo", "random" };
+    int64_t accesses = c->reads + c->writes, misses = c->read_misses + c->write_misses;
+    fprintf(fp, "\n%s: %d bytes, %d-way, %d byte lines, %d sets, %s, write-%s, miss penalty %d\n", c->name, c->size,
+        c->assoc, c->line, c->sets, replace[c->replace], c->write_back ? "back" : "through", c->penalty);
+    fprintf(fp, "accesses:   %12lld (%lld reads, %lld writes)\n", (long long)accesses, (long long)c->reads, (long long)c->writes);
+    fprintf(fp, "misses:     %12lld (%6.2f%%, %lld read, %lld write)\n", (long long)misses,
+        accesses ? misses * 100.0 / accesses : 0, (long long)c->read_misses, (long long)c->write_misses);
+    if(c->write_back && c->writes) fprintf(fp, "writebacks: %12lld\n", (long long)c->writebacks);
+    fprintf(fp, "miss cycles: %11lld\n", (long long)cache_cost(c));
+
+    //misses, line pairs sorted by misses
+    int lines = MEMORY_SIZE / c->line, count = 0;
+    int64_t (*top)[2] = malloc(lines * sizeof(*top));
+    for(int i = 0; i < lines; i++)
+        if(c->misses[i]) { top[count][0] = c->misses[i]; top[count++][1] = i; }
+    qsort(top, count, sizeof(*top), cache_compare);
+    if(count) fprintf(fp, "line   | misses\n");
+    for(int i = 0; i < count && i < CACHE_TOP; i++)
+        fprintf(fp, "0x%04X | %lld\n", (int)(top[i][1] * c->line >> c->data), (long long)top[i][0]);
+    free(top);
+}
+
+#pragma endregion
+
+//PREDICTOR
+#pragma region
+
+/*
+Branch prediction model fed with the outcomes interpret() computes. bnz direction comes from one of
+static not-taken, bimodal (2 bit counters indexed by pc) or gshare (counters indexed by pc xor the
+global history). Returns (jal x0, ra+0) pop a return address stack that calls (jal ra, ...) push,
+every other jal is predicted from a last target table. A wrong direction or target costs the
+mispredict penalty.
+
+Spec: static, bimodal or gshare, optionally followed by ,bits=N ,ras=N ,penalty=N
+*/
+
+#define PREDICTOR_TOP 20
+
+enum { PREDICT_STATIC, PREDICT_BIMODAL, PREDICT_GSHARE };
+
+typedef struct predictor_pc {
+    int64_t executed, taken, mispredicts;
+} predictor_pc;
+
+struct predictor {
+    int kind, bits, penalty;
+    uint8_t *counters;      //2 bit saturating, taken from 2 up
+    uint32_t history;
+    uint16_t *ras;
+    int ras_size, ras_top, ras_depth;
+    uint16_t targets[0x8000];
+    int64_t branches, branch_misses, returns, return_misses, jumps, jump_misses;
+    predictor_pc pcs[0x8000];
+};
+
+predictor *predictor_new(char *spec) {
+    static char *kinds[] = { "static", "bimodal", "gshare" };
+    predictor *bp = calloc(1, sizeof(predictor));
+    bp->kind = -1;
+    bp->bits = 10;
+    bp->ras_size = 8;
+    bp->penalty = PIPELINE_FLUSH;
+    for(int i = 0; i < 3; i++) {
+        int n = strlen(kinds[i]);
+        if(!strncmp(spec, kinds[i], n) && (spec[n] == 0 || spec[n] == ',')) {
+            bp->kind = i;
+            spec += n;
+        }
+    }
+    if(bp->kind < 0) {
+        printf("Predictor must be static, bimodal or gshare\n");
+        free(bp);
+        return 0;
+    }
+    char key[16];
+    int value, n;
+    while(*spec) {
+        if(sscanf(spec, ",%15[^=]=%i%n", key, &value, &n) != 2) {
+            printf("Malformed predictor spec at [%s]\n", spec);
+            free(bp);
+            return 0;
+        }
+        spec += n;
+        if(!strcmp(key, "bits") && value > 0 && value <= 16) bp->bits = value;
+        else if(!strcmp(key, "ras") && value > 0) bp->ras_size = value;
+        else if(!strcmp(key, "penalty") && value >= 0) bp->penalty = value;
+        else {
+            printf("Bad predictor setting %s=%i\n", key, value);
+            free(bp);
+            return 0;
+        }
+    }
+    bp->counters = malloc(1 << bp->bits);
+    memset(bp->counters, 1, 1 << bp->bits);
+    bp->ras = calloc(bp->ras_size, sizeof(uint16_t));
+    return bp;
+}
+
+void predictor_free(predictor *bp) {
+    free(bp->counters);
+    free(bp->ras);
+    free(bp);
+}
+
+//one executed instruction, taken is set for a taken bnz
+void predictor_step(predictor *bp, uint16_t pc, uint16_t instr, int taken, uint16_t next_pc) {
+    int opcode = instr >> 12, rd = (instr >> 8) & 15, rs1 = (instr >> 4) & 15, imm = instr & 15;
+    predictor_pc *at = bp->pcs + (pc >> 1);
+    int miss;
+    if(opcode == 14) {
+        uint32_t mask = (1 << bp->bits) - 1;
+        uint32_t index = ((pc >> 1) ^ (bp->kind == PREDICT_GSHARE ? bp->history : 0)) & mask;
+        uint8_t *counter = bp->counters + index;
+        int predicted = bp->kind != PREDICT_STATIC && *counter >= 2;
+        miss = predicted != taken;
+        if(taken && *counter < 3) (*counter)++;
+        if(!taken && *counter > 0) (*counter)--;
+        bp->history = (bp->history << 1 | taken) & mask;
+        bp->branches++;
+        bp->branch_misses += miss;
+        at->taken += taken;
+    } else if(opcode == 15 && rd == 0 && rs1 == 2 && imm == 0) {
+        //an empty stack predicts nothing
+        miss = !bp->ras_depth || bp->ras[bp->ras_top] != next_pc;
+        if(bp->ras_depth) {
+            bp->ras_top = (bp->ras_top + bp->ras_size - 1) % bp->ras_size;
+            bp->ras_depth--;
+        }
+        bp->returns++;
+        bp->return_misses += miss;
+    } else if(opcode == 15) {
+        if(rd == 2) {
+            bp->ras_top = (bp->ras_top + 1) % bp->ras_size;
+            bp->ras[bp->ras_top] = pc + 2;
+            if(bp->ras_depth < bp->ras_size) bp->ras_depth++;
+        }
+        miss = bp->targets[pc >> 1] != next_pc;
+        bp->targets[pc >> 1] = next_pc;
+        bp->jumps++;
+        bp->jump_misses += miss;
+    } else {
+        return;
+    }
+    at->executed++;
+    at->mispredicts += miss;
+}
+
+int64_t predictor_cost(predictor *bp) {
+    return (bp->branch_misses + bp->return_misses + bp->jump_misses) * bp->penalty;
+}
+
+int predictor_compare(const void *a, const void *b) {
+    int64_t x = ((int64_t*)a)[0], y = ((int64_t*)b)[0];
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void predictor_report(predictor *bp, processor *p, FILE *fp) {
+    static char *kinds[] = { "static not-taken", "bimodal", "gshare" };
+    void fprint_instruction(FILE *fp, uint16_t instr);
+    #define ACCURACY(n, m) ((n) ? ((n) - (m)) * 100.0 / (n) : 100.0)
+
+    fprintf(fp, "\npredictor: %s", kinds[bp->kind]);
+    if(bp->kind != PREDICT_STATIC) fprintf(fp, ", %d counters", 1 << bp->bits);
+    fprintf(fp, ", %d entry return stack, mispredict penalty %d\n", bp->ras_size, bp->penalty);
+    fprintf(fp, "branches: %12lld mispredicted %12lld (%6.2f%% accurate)\n", (long long)bp->branches,
+        (long long)bp->branch_misses, ACCURACY(bp->branches, bp->branch_misses));
+    fprintf(fp, "returns:  %12lld mispredicted %12lld (%6.2f%% accurate)\n", (long long)bp->returns,
+        (long long)bp->return_misses, ACCURACY(bp->returns, bp->return_misses));
+    fprintf(fp, "jumps:    %12lld mispredicted %12lld (%6.2f%% accurate)\n", (long long)bp->jumps,
+        (long long)bp->jump_misses, ACCURACY(bp->jumps, bp->jump_misses));
+    fprintf(fp, "mispredict cycles: %lld\n", (long long)predictor_cost(bp));
+
+    //mispredicts, pc pairs sorted by mispredicts
+    int64_t (*top)[2] = malloc(0x8000 * sizeof(*top));
+    int count = 0;
+    for(int i = 0; i < 0x8000; i++)
+        if(bp->pcs[i].executed) { top[count][0] = bp->pcs[i].mispredicts; top[count++][1] = i; }
+    qsort(top, count, sizeof(*top), predictor_compare);
+
+    fprintf(fp, "\naddr   | instruction       | executed     | taken        | mispredicts  | accuracy\n");
+    for(int i = 0; i < count && i < PREDICTOR_TOP; i++) {
+        predictor_pc *at = bp->pcs + top[i][1];
+        uint16_t instr = ((uint16_t*)p->memory)[top[i][1]];
+        fprintf(fp, "0x%04X | ", (int)top[i][1] * 2);
+        fprint_instruction(fp, instr);
+        if(instr >> 12 == 14) fprintf(fp, " | %12lld | %12lld", (long long)at->executed, (long long)at->taken);
+        else fprintf(fp, " | %12lld | %12s", (long long)at->executed, "");
+        fprintf(fp, " | %12lld | %6.2f%%\n", (long long)at->mispredicts, ACCURACY(at->executed, at->mispredicts));
+    }
+    free(top);
+    #undef ACCURACY
+}
+
+#pragma endregion
+
+//DEVICES
+#pragma region
+
+/*
+Devices sit on the word addresses they are attached at. Memory stays the backing store: a device
+read is written into memory as well as loaded, and a device write comes after sw has stored the
+word. Engines take the values from the bus rather than memory, since harts sharing memory would
+race on it. Engines only consult the bus for lw/sw into a page marked in io_pages.
+
+Watchpoints ride on the same check: arming one flags its pages PAGE_WATCH, so lw and sw on pages
+without devices or watchpoints pay nothing extra and other instructions never look. On a flagged
+page the bus compares the word against the watchpoints; a hit prints the watchpoint's message, or
+stops the run with STOP_WATCH after the access has completed if it has none.
+
+Standard devices, their addresses are defined in interpret.h:
+0x400       console in      lw reads the next input
+0x402       console out     sw stops the run with STOP_OUTPUT
+0x404-0x405 timer           lw 0x404 reads the low word of the cycle count and latches the high word into 0x405
+0x406       exit            sw stops the run with STOP_EXIT, the word is the exit code
+0x408-0x40B block transfer  sw 0x40B copies [0x40A] words from [0x408] to [0x409]
+*/
+
+//device on word a, the page of a is known to hold one
+device *bus_find(processor *p, uint16_t a) {
+    for(device *d = p->devices; d < p->devices + p->device_count; d++)
+        if((uint16_t)(a - d->base) < d->size) return d;
+    return 0;
+}
+
+//an lw or sw of value at word a, on a page with watchpoints; returns STOP_WATCH if one without a message hit
+int watch_access(processor *p, uint16_t a, int write, int16_t value) {
+    void interpret_debug_msg(processor *p, char *str);
+    int stop = STOP_NONE;
+    for(watchpoint *w = p->watchpoints; w < p->watchpoints + p->watch_count; w++) {
+        if((uint16_t)(a - w->addr) >= w->count) continue;
+        int hit = w->kinds & (write ? WATCH_WRITE : WATCH_READ);
+        if(write && (w->kinds & WATCH_CHANGE) && w->values[a - w->addr] != value) hit |= WATCH_CHANGE;
+        w->values[a - w->addr] = value;
+        if(!hit) continue;
+        p->watch_addr = a;
+        p->watch_pc = p->PC;
+        p->watch_kind = hit;
+        if(w->debug_msg) interpret_debug_msg(p, w->debug_msg);
+        else stop = STOP_WATCH;
+    }
+    return stop;
+}
+
+//lw from a device or watched page, p->cycle and p->PC must be current; returns a stop reason
+int bus_read(processor *p, uint16_t a, int16_t *value) {
+    device *d = bus_find(p, a);
+    if(!d || !d->read) *value = ((int16_t*)p->memory)[a];
+    else {
+        *value = d->read(p, a);
+        ((int16_t*)p->memory)[a] = *value;
+        p->dirty[a >> 7] = 1;
+    }
+    return p->io_pages[a >> 8] & PAGE_WATCH ? watch_access(p, a, 0, *value) : STOP_NONE;
+}
+
+//after an sw of value to a device or watched page, returns a stop reason; a device's goes first
+int bus_write(processor *p, uint16_t a, int16_t value) {
+    int watch = p->io_pages[a >> 8] & PAGE_WATCH ? watch_access(p, a, 1, value) : STOP_NONE;
+    device *d = bus_find(p, a);
+    int stop = d && d->write ? d->write(p, a, value) : STOP_NONE;
+    return stop != STOP_NONE ? stop : watch;
+}
+
+int processor_add_watchpoint(processor *p, uint16_t addr, uint16_t count, int kinds, char *debug_msg) {
+    if(!count || addr + count > 0x10000 || !(kinds & (WATCH_READ | WATCH_WRITE | WATCH_CHANGE))) return -1;
+    p->watchpoints = realloc(p->watchpoints, (p->watch_count + 1) * sizeof(watchpoint));
+    watchpoint *w = p->watchpoints + p->watch_count++;
+    *w = (watchpoint){ .addr = addr, .count = count, .kinds = kinds, .debug_msg = debug_msg };
+    w->values = malloc(count * sizeof(int16_t));
+    memcpy(w->values, (int16_t*)p->memory + addr, count * sizeof(int16_t));
+    for(int page = addr >> 8; page <= (addr + count - 1) >> 8; page++) p->io_pages[page] |= PAGE_WATCH;
+    //compiled code only leaves for the pages flagged when it was made
+    void jit_free(jit *j);
+    jit_free(p->run_jit);
+    p->run_jit = 0;
+    return 0;
+}
+
+int processor_remove_watchpoints(processor *p, uint16_t addr) {
+    int removed = 0;
+    for(int i = 0; i < p->watch_count; i++) {
+        watchpoint *w = p->watchpoints + i;
+        if(w->addr == addr) {
+            free(w->values);
+            processor_free_msg(p, w->debug_msg);
+            removed++;
+        } else {
+            p->watchpoints[i - removed] = *w;
+        }
+    }
+    p->watch_count -= removed;
+    for(int page = 0; page < 256; page++) p->io_pages[page] &= ~PAGE_WATCH;
+    for(watchpoint *w = p->watchpoints; w < p->watchpoints + p->watch_count; w++)
+        for(int page = w->addr >> 8; page <= (w->addr + w->count - 1) >> 8; page++) p->io_pages[page] |= PAGE_WATCH;
+    return removed;
+}
+
+int processor_watch_hit(processor *p, uint16_t *addr, uint16_t *pc) {
+    if(addr) *addr = p->watch_addr;
+    if(pc) *pc = p->watch_pc;
+    return p->watch_kind;
+}
+
+void watch_report(processor *p, FILE *fp) {
+    int kind = p->watch_kind;
+    fprintf(fp, "watch: %s 0x%04X at 0x%04X\n", kind & WATCH_CHANGE ? "change" : kind & WATCH_WRITE ? "write" : "read", p->watch_addr, p->watch_pc);
+}
+
+//letters r, w and c as WATCH_ kinds, 0 if there is anything else
+int watch_kinds(char *letters) {
+    int kinds = 0;
+    for(; *letters; letters++) {
+        if(*letters == 'r') kinds |= WATCH_READ;
+        else if(*letters == 'w') kinds |= WATCH_WRITE;
+        else if(*letters == 'c') kinds |= WATCH_CHANGE;
+        else return 0;
+    }
+    return kinds;
+}
+
+int16_t console_read(processor *p, uint16_t a) {
+    return processor_input(p);
+}
+
+int console_write(processor *p, uint16_t a, int16_t value) {
+    return STOP_OUTPUT;
+}
+
+int16_t timer_read(processor *p, uint16_t a) {
+    if(a == DEVICE_TIMER + 1) return ((int16_t*)p->memory)[a];
+    ((int16_t*)p->memory)[DEVICE_TIMER + 1] = p->cycle >> 16;
+    return p->cycle;
+}
+
+int exit_write(processor *p, uint16_t a, int16_t value) {
+    return STOP_EXIT;
+}
+
+int block_write(processor *p, uint16_t a, int16_t value) {
+    if(a != DEVICE_BLOCK + 3) return STOP_NONE;
+    int16_t *mem = (int16_t*)p->memory;
+    uint16_t src = mem[DEVICE_BLOCK], dst = mem[DEVICE_BLOCK + 1], count = mem[DEVICE_BLOCK + 2];
+    //overlapping copies behave like memmove
+    int step = (uint16_t)(dst - src) < count ? -1 : 1;
+    if(step < 0) {
+        src += count - 1;
+        dst += count - 1;
+    }
+    for(int i = 0; i < count; i++, src += step, dst += step) {
+        mem[dst] = mem[src];
+        processor_stored(p, dst);
+    }
+    return STOP_NONE;
+}
+
+void bus_attach_standard(processor *p) {
+    processor_attach(p, (device){ DEVICE_CONSOLE_IN, 1, console_read, 0 });
+    processor_attach(p, (device){ DEVICE_CONSOLE_OUT, 1, 0, console_write });
+    processor_attach(p, (device){ DEVICE_TIMER, 2, timer_read, 0 });
+    processor_attach(p, (device){ DEVICE_EXIT, 1, 0, exit_write });
+    processor_attach(p, (device){ DEVICE_BLOCK, 4, 0, block_write });
+}
+
+#pragma endregion
+
+//STREAM
+#pragma region
+
+/*
+Streaming console for programs that consume and produce many values in one run. Input comes from a
+file, mapped whole when it is a regular file, or from a pipe read STREAM_CHUNK bytes at a time, and
+is handed out one integer per lw 0x400. lw 0x401 reads 1 while more input is left, 0 at the end.
+sw 0x402 appends the value as a line to p->out and the program keeps running; debug messages go to
+the same FILE, so with a large stdio buffer neither costs a write per value.
+*/
+
+#define STREAM_CHUNK (1 << 16)
+#define DEVICE_CONSOLE_STATUS 0x401
+
+struct stream {
+    char *buf;
+    size_t pos, len;
+    int fd;
+    int mapped;
+    int eof;
+};
+
+stream *stream_open(char *path) {
+    int fd = path ? open(path, O_RDONLY) : 0;
+    if(fd < 0) return 0;
+    stream *s = calloc(1, sizeof(stream));
+    s->fd = fd;
+    struct stat st;
+    if(!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+        s->buf = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(s->buf != MAP_FAILED) {
+            s->len = st.st_size;
+            s->mapped = s->eof = 1;
+            return s;
+        }
+    }
+    s->buf = malloc(STREAM_CHUNK);
+    return s;
+}
+
+void stream_close(stream *s) {
+    if(!s) return;
+    if(s->mapped) munmap(s->buf, s->len);
+    else free(s->buf);
+    if(s->fd) close(s->fd);
+    free(s);
+}
+
+//makes at least one more byte available unless the input has ended, keeping the unread tail
+int stream_fill(stream *s) {
+    if(s->eof) return 0;
+    memmove(s->buf, s->buf + s->pos, s->len - s->pos);
+    s->len -= s->pos;
+    s->pos = 0;
+    ssize_t n = read(s->fd, s->buf + s->len, STREAM_CHUNK - s->len);
+    if(n <= 0) s->eof = 1;
+    else s->len += n;
+    return n > 0;
+}
+
+//skips whitespace, returns the next byte or -1 at the end
+int stream_peek(stream *s) {
+    while(1) {
+        while(s->pos < s->len && strchr(" \t\r\n,", s->buf[s->pos])) s->pos++;
+        if(s->pos < s->len) return (uint8_t)s->buf[s->pos];
+        if(!stream_fill(s)) return -1;
+    }
+}
+
+int stream_byte(stream *s) {
+    if(s->pos == s->len && !stream_fill(s)) return -1;
+    return (uint8_t)s->buf[s->pos];
+}
+
+//next decimal or 0x hex integer, 0 at the end of the input; a stray character reads as 0
+int16_t stream_next(stream *s) {
+    int c = stream_peek(s), sign = 1, base = 10, value = 0, digit;
+    if(c < 0) return 0;
+    if(c == '-' || c == '+') {
+        sign = c == '-' ? -1 : 1;
+        s->pos++;
+    }
+    if(stream_byte(s) == '0') {
+        s->pos++;
+        if(stream_byte(s) == 'x' || stream_byte(s) == 'X') {
+            base = 16;
+            s->pos++;
+        }
+    }
+    while((c = stream_byte(s)) >= 0) {
+        if(c >= '0' && c <= '9') digit = c - '0';
+        else if(base == 16 && (c | 32) >= 'a' && (c | 32) <= 'f') digit = (c | 32) - 'a' + 10;
+        else break;
+        value = value * base + digit;
+        s->pos++;
+    }
+    if(c >= 0 && !strchr(" \t\r\n,", c)) s->pos++;
+    return sign * value;
+}
+
+int16_t stream_read(processor *p, uint16_t a) {
+    if(a == DEVICE_CONSOLE_STATUS) return stream_peek(p->stream) >= 0;
+    return stream_next(p->stream);
+}
+
+int stream_write(processor *p, uint16_t a, int16_t value) {
+    if(!p->out) return STOP_NONE;
+    char digits[8], *d = digits + 8;
+    int v = value < 0 ? -value : value;
+    *--d = '\n';
+    do *--d = '0' + v % 10; while(v /= 10);
+    if(value < 0) *--d = '-';
+    fwrite(d, 1, digits + 8 - d, p->out);
+    return STOP_NONE;
+}
+
+//switches the console devices of p over to s
+void processor_stream(processor *p, stream *s) {
+    p->stream = s;
+    for(int i = 0; i < p->device_count; i++) {
+        if(p->devices[i].base == DEVICE_CONSOLE_IN) p->devices[i].read = stream_read;
+        if(p->devices[i].base == DEVICE_CONSOLE_OUT) p->devices[i].write = stream_write;
+    }
+    processor_attach(p, (device){ DEVICE_CONSOLE_STATUS, 1, stream_read, 0 });
+}
+
+#pragma endregion
+
+//INTERPRETER
+#pragma region
+
+void interpret_control(processor *p, int16_t opcode, int *mem_read, int16_t *ALU_op, int *use_imm, int *use_rd, int *reg_write) {
+    switch(opcode) {
+        case 0:  *mem_read = 0; *ALU_op = 0; *use_imm = 0; *use_rd = 0; *reg_write = 1; break;
+        case 1:  *mem_read = 0; *ALU_op = 0; *use_imm = 1; *use_rd = 0; *reg_write = 1; break;
+        case 2:  *mem_read = 0; *ALU_op = 0; *use_imm = 1; *use_rd = 1; *reg_write = 1; break;
+        case 3:  *mem_read = 0; *ALU_op = 1; *use_imm = 0; *use_rd = 0; *reg_write = 1; break;
+        case 4:  *mem_read = 0; *ALU_op = 2; *use_imm = 0; *use_rd = 0; *reg_write = 1; break;
+        case 5:  *mem_read = 0; *ALU_op = 3; *use_imm = 0; *use_rd = 0; *reg_write = 1; break;
+        case 6:  *mem_read = 0; *ALU_op = 4; *use_imm = 0; *use_rd = 0; *reg_write = 1; break;
+        case 7:  *mem_read = 0; *ALU_op = 5; *use_imm = 0; *use_rd = 0; *reg_write = 1; break;
+        case 8:  *mem_read = 1; *ALU_op = 0; *use_imm = 1; *use_rd = 0; *reg_write = 1; break;
+        case 9:  *mem_read = 0; *ALU_op = 0; *use_imm = 1; *use_rd = 0; *reg_write = 0; break;
+        case 10: *mem_read = 0; *ALU_op = 8; *use_imm = 1; *use_rd = 1; *reg_write = 1; break;
+        case 11: *mem_read = 0; *ALU_op = 9; *use_imm = 1; *use_rd = 1; *reg_write = 1; break;
+        case 12: *mem_read = 0; *ALU_op = 6; *use_imm = 0; *use_rd = 0; *reg_write = 1; break;
+        case 13: *mem_read = 0; *ALU_op = 7; *use_imm = 0; *use_rd = 0; *reg_write = 1; break;
+        case 14: *mem_read = 0; *ALU_op = 8; *use_imm = 1; *use_rd = 1; *reg_write = 0; break;
+        case 15: *mem_read = 0; *ALU_op = 0; *use_imm = 1; *use_rd = 0; *reg_write = 1; break;
+    }
+}
+
+void interpret_reg_file(processor *p, int rs1, int rs2, int rd, int reg_write, int data, int16_t *rs1_out, int16_t *rs2_out, int16_t *rd_out) {
+    *rs1_out = p->registers[rs1];
+    *rs2_out = p->registers[rs2];
+    *rd_out = p->registers[rd];
+
+    if(reg_write && rd > 1) {
+        p->registers[rd] = data;
+    }
+}
+
+void interpret_imm_gen(processor *p, uint16_t instr, int16_t *imm) {
+    switch(bits(15, 12)) {
+        case 1:  
+        case 8:  
+        case 9:  
+        case 15: *imm = (bits(3, 0) << 28 >> 28); break; //the shifting is to make the value signed
+        case 2:  
+        case 10: 
+        case 11: 
+        case 14: *imm = (bits(7, 0) << 24 >> 24); break; //the shifting is to make the value signed
+    }
+}
+
+void interpret_ALU(processor *p, int ALU_op, int16_t A, int16_t B, int16_t *ALU_out) {
+    switch (ALU_op) {
+        case 0: *ALU_out = A + B;    break;
+        case 1: *ALU_out = A - B;    break;
+        case 2: *ALU_out = A << B;   break;
+        case 3: *ALU_out = A & B;    break;
+        case 4: *ALU_out = A | B;    break;
+        case 5: *ALU_out = A ^ B;    break;
+        case 6: *ALU_out = (A == B); break;
+        case 7: *ALU_out = (A < B);  break;
+        case 8: *ALU_out = B;        break;
+        case 9: *ALU_out = (B << 8); break;
+    }
+}
+
+void interpret_memory(processor *p, int mem_read, int mem_write, int16_t addr, int16_t data, int16_t *mem_out) {
+    if(mem_read) {
+        *mem_out = ((int16_t*)p->memory)[(uint16_t)addr];
+    }
+    if(mem_write) {
+        ((int16_t*)p->memory)[(uint16_t)addr] = data;
+        p->dirty[(uint16_t)addr >> 7] = 1;
+    }
+}
+
+void interpret_debug_msg(processor *p, char *str) {
+    if(!str || !p->out) return;
+    #define reg(n) p->registers[str[n + 1]]
+    char *fmt = str + 1 + str[0];
+    switch (str[0]) {
+        case 0:  fprintf(p->out, fmt); break;
+        case 1:  fprintf(p->out, fmt, reg(0)); break;
+        case 2:  fprintf(p->out, fmt, reg(0), reg(1)); break;
+        case 3:  fprintf(p->out, fmt, reg(0), reg(1), reg(2)); break;
+        case 4:  fprintf(p->out, fmt, reg(0), reg(1), reg(2), reg(3)); break;
+        case 5:  fprintf(p->out, fmt, reg(0), reg(1), reg(2), reg(3), reg(4)); break;
+        default: fprintf(p->out, fmt, reg(0), reg(1), reg(2), reg(3), reg(4), reg(5)); break;
+    }
+    fprintf(p->out, "\n");
+    #undef reg
+}
+
+int interpret(processor *p, int debug) {
+    p->registers[0] = 0;
+    p->registers[1] = -1;
+    p->jit = 0;
+    if(debug) printf("addr   | instruction\n");
+    void print_instruction(uint16_t instr);
+    int64_t cycle = p->cycle, resume = cycle;
+    int64_t limit = p->cycle_limit ? p->cycle_limit : INT64_MAX;
+
+    while(1) {
+        if(cycle >= limit) {
+            p->cycle = cycle;
+            return STOP_BUDGET;
+        }
+
+        //debug stuff
+        if(p->bp_index[p->PC >> 1]) {
+            //a run never stops on the pause it starts at, so running again continues past it
+            if(p->stop_on_pause && cycle != resume && processor_paused(p, p->PC)) {
+                p->cycle = cycle;
+                return STOP_BREAK;
+            }
+            for(breakpoint *bp = processor_breakpoint(p, p->PC); bp; bp = processor_next_breakpoint(p, bp))
+                interpret_debug_msg(p, bp->debug_msg);
+        }
+
+        //program unit
+        uint16_t instr = *(uint16_t*)(p->memory + p->PC);
+        if(p->icache) cache_access(p->icache, p->PC, 0);
+        int bnz = (bits(15, 12) == 14);
+        int jal = (bits(15, 12) == 15);
+
+        if(debug) {
+            printf("0x%04X | ", p->PC);
+            print_instruction(instr);
+            printf("\n", instr);
+        }
+
+        //control
+        int mem_read;
+        int16_t ALU_op;
+        int use_imm;
+        int use_rd;
+        int reg_write;
+        interpret_control(p, bits(15, 12), &mem_read, &ALU_op, &use_imm, &use_rd, &reg_write);
+
+        //ImmGen
+        int16_t imm;
+        interpret_imm_gen(p, instr, &imm);
+
+        //RegFile read
+        int16_t data;
+        int16_t rd_out = p->registers[bits(11, 8)];
+        int16_t rs1_out = p->registers[bits(7, 4)];
+        int16_t rs2_out = p->registers[bits(3, 0)];
+
+        interpret_reg_file(p, bits(7, 4), bits(3, 0), bits(11, 8), 0, data, &rs1_out, &rs2_out, &rd_out);
+        
+        //ALU
+        int16_t ALU_out;
+        int16_t A = use_rd ? rd_out : rs1_out;
+        int16_t B = use_imm ? imm : rs2_out;
+        interpret_ALU(p, ALU_op, A, B, &ALU_out);
+
+        //Memory
+        int16_t mem_out;
+        int mem_write = !reg_write && !bnz;
+        int io = (mem_read || mem_write) ? p->io_pages[(uint16_t)ALU_out >> 8] : 0;
+        if(io) p->cycle = cycle;
+        if(p->dcache && (mem_read || mem_write) && !(io & PAGE_DEVICE)) cache_access(p->dcache, (uint16_t)ALU_out * 2, mem_write);
+        interpret_memory(p, mem_read, mem_write, ALU_out, rd_out, &mem_out);
+        int read_stop = io && mem_read ? bus_read(p, ALU_out, &mem_out) : STOP_NONE;
+
+        if(io && mem_write) {
+            int stop = bus_write(p, ALU_out, rd_out);
+            if(stop != STOP_NONE) {
+                if(p->trace) trace_step(p->trace, p->PC, instr, rd_out, ALU_out);
+                if(p->vcd) vcd_step(p->vcd, cycle, p->PC, instr, ALU_op, ALU_out, 0, 0, ALU_out, rd_out != 0, p->PC + 2, p->registers);
+                return stop;
+            }
+        }
+        
+        //muxes
+        int16_t mux2_out = mem_read ? mem_out : ALU_out;
+        int not_zero = (rd_out != 0);
+        int16_t and_value = bnz && not_zero;
+
+        int16_t add_in = and_value ? mux2_out : 2;
+        uint16_t add_out = add_in + p->PC;
+
+        uint16_t next_PC = jal ? mux2_out : add_out;
+        data = jal ? add_out : mux2_out;
+
+        //RegFile write
+        interpret_reg_file(p, bits(7, 4), bits(3, 0), bits(11, 8), reg_write, data, &rs1_out, &rs2_out, &rd_out);
+        if(p->vcd) vcd_step(p->vcd, cycle, p->PC, instr, ALU_op, ALU_out, mem_read, mem_out, mux2_out, not_zero, next_PC, p->registers);
+        //an lw stops once its register is written, the way an sw stops once it has stored
+        if(read_stop != STOP_NONE) {
+            if(p->trace) trace_step(p->trace, p->PC, instr, data, ALU_out);
+            return read_stop;
+        }
+
+        if(p->prof) profile_step(p->prof, p->PC, instr, and_value, next_PC);
+        if(p->trace) trace_step(p->trace, p->PC, instr, mem_write ? rd_out : data, ALU_out);
+        if(p->pipe) pipeline_step(p->pipe, p->PC, instr, and_value);
+        if(p->bpred) predictor_step(p->bpred, p->PC, instr, and_value, next_PC);
+
+        cycle++;
+
+        if(next_PC == p->PC) {
+            p->cycle = cycle;
+            return STOP_HALT;
+        }
+        p->PC = next_PC;
+        #undef rd
+        #undef rs1
+        #undef rs2
+    }
+}
+
+
+#pragma endregion
+
+//FAST INTERPRETER
+#pragma region
+
+//handlers for pre-decoded instructions; F_DECODE is zero so a fresh or invalidated slot decodes itself on first use
+enum {
+    F_DECODE, F_NOP, F_ADD, F_ADDI, F_SUB, F_SHL, F_AND, F_OR, F_XOR, F_LW, F_SW,
+    F_LI, F_EQ, F_LT, F_BNZ, F_BRA, F_SPIN, F_JAL, F_BREAK, F_LOOP
+};
+
+void decode_instr(processor *p, uint16_t pc, decoded *o) {
+    uint16_t instr = *(uint16_t*)(p->memory + pc);
+    int opcode = bits(15, 12), rd = bits(11, 8);
+    int16_t imm4 = (bits(3, 0) << 28 >> 28), imm8 = (bits(7, 0) << 24 >> 24);
+    *o = (decoded){ .rd = rd, .rs1 = bits(7, 4), .rs2 = bits(3, 0) };
+    switch(opcode) {
+        case 0:  o->op = F_ADD; break;
+        case 1:  o->op = F_ADDI; o->imm = imm4; break;
+        case 2:  o->op = F_ADDI; o->imm = imm8; o->rs1 = rd; break;
+        case 3:  o->op = F_SUB; break;
+        case 4:  o->op = F_SHL; break;
+        case 5:  o->op = F_AND; break;
+        case 6:  o->op = F_OR;  break;
+        case 7:  o->op = F_XOR; break;
+        case 8:  o->op = F_LW;  o->imm = imm4; break;
+        case 9:  o->op = F_SW;  o->imm = imm4; break;
+        case 10: o->op = F_LI;  o->imm = imm8; break;
+        case 11: o->op = F_LI;  o->imm = imm8 << 8; break;
+        case 12: o->op = F_EQ;  break;
+        case 13: o->op = F_LT;  break;
+        case 14: o->op = rd == 0 ? F_NOP : imm8 == 0 ? F_SPIN : imm8 < 0 ? F_LOOP : rd == 1 ? F_BRA : F_BNZ; o->imm = imm8; break;
+        case 15: o->op = F_JAL; o->imm = imm4; break;
+    }
+    //x0 and x1 are never written, so plain ALU ops targeting them do nothing
+    if(rd <= 1 && opcode != 8 && opcode != 9 && opcode < 14) o->op = F_NOP;
+
+    if(p->bp_index[pc >> 1] && processor_breakpoint(p, pc)) {
+        o->inner = o->op;
+        o->op = F_BREAK;
+    }
+}
+
+void processor_decode(processor *p) {
+    if(!p->ops) p->ops = calloc(UINT16_MAX + 1, sizeof(decoded));
+    for(int i = 0; i < p->instructions; i++)
+        decode_instr(p, i * 2, p->ops + i * 2);
+}
+
+/*
+A backward bnz decodes to F_LOOP. Reaching it with its register nonzero, the body from the target up
+to the bnz is checked for straight line register code whose iterations have a closed form:
+- a register written with x += k or x -= k, k an immediate or a register that stays the same,
+  and read by nothing else in the body, gains m * k after m iterations;
+- any other write reads only registers the body does not write or has already set this way, so
+  it sets the same value every time.
+The bnz register then either steps by a constant d, leaving c + n * d == 0 after n more iterations,
+or never changes. The remaining iterations are applied at once and the cycles advance by n times the
+body length, so they stay exact; a cycle budget that ends inside the loop gets as many whole
+iterations as fit and runs the rest one by one. A loop whose register never reaches zero and whose
+body changes nothing is idle: it runs to the budget at once, or without one ends the run like a
+halt. Bodies with memory accesses, jumps or unsupported writes demote the bnz to F_BNZ for good; a
+loop with an undecoded instruction or a breakpoint is stepped this time and looked at again.
+interpret() runs every cycle regardless, the profiler, trace and waveform need them.
+*/
+
+enum { LOOP_STEP = -1, LOOP_HALT = -2 };
+
+//iterations until c + n * d wraps to zero, 0 if it never does
+uint32_t loop_trips(uint16_t c, uint16_t d) {
+    if(!d) return 0;
+    int shift = __builtin_ctz(d);
+    if(c & ((1 << shift) - 1)) return 0;
+    //d is odd once the shared powers of two are gone; Newton's iteration inverts it mod 2^16
+    uint32_t odd = d >> shift, inverse = odd;
+    for(int i = 0; i < 4; i++) inverse *= 2 - odd * inverse;
+    return ((uint32_t)(uint16_t)-c >> shift) * inverse & (0xFFFF >> shift);
+}
+
+//at the F_LOOP at pc with its register nonzero; returns the pc to go on at with cycle advanced, or a LOOP_ code
+int loop_forward(processor *p, uint16_t pc, int64_t *cycle, int64_t limit) {
+    decoded *ops = p->ops, *bnz = ops + pc;
+    int16_t *r = p->registers;
+    int start = pc + bnz->imm, length = (pc - start) / 2 + 1;
+    int8_t writer[16];
+    uint8_t reads[16] = { 0 }, accumulates[16] = { 0 };
+    int16_t value[16];
+    memset(writer, -1, sizeof(writer));
+    if(start < 0 || (bnz->imm & 1)) goto demote;
+
+    for(int i = 0; i < length - 1; i++) {
+        decoded *o = ops + start + 2 * i;
+        if(o->op == F_DECODE || o->op == F_BREAK) return LOOP_STEP;
+        if(o->op == F_NOP) continue;
+        if(o->op > F_LT || o->op == F_LW || o->op == F_SW || writer[o->rd] >= 0) goto demote;
+        writer[o->rd] = i;
+        if(o->op != F_LI) reads[o->rs1]++;
+        if(o->op != F_LI && o->op != F_ADDI) reads[o->rs2]++;
+    }
+    //registers as the body leaves them, for the ones it sets to the same value every time
+    int16_t v[16];
+    uint8_t set[16] = { 0 };
+    memcpy(v, r, sizeof(v));
+    #define STABLE(y) (writer[y] < 0 || (writer[y] < i && set[y]))
+    for(int i = 0; i < length - 1; i++) {
+        decoded *o = ops + start + 2 * i;
+        int x = o->rd, y = o->rs1 == x ? o->rs2 : o->rs1;
+        if(o->op == F_NOP) continue;
+        if(o->op == F_ADDI && o->rs1 == x && reads[x] == 1) {
+            accumulates[x] = 1;
+            value[x] = o->imm;
+        } else if((o->op == F_ADD || (o->op == F_SUB && o->rs1 == x)) && (o->rs1 == x) != (o->rs2 == x) && STABLE(y) && reads[x] == 1) {
+            accumulates[x] = 1;
+            value[x] = o->op == F_SUB ? -v[y] : v[y];
+        } else {
+            if(o->op != F_LI && !STABLE(o->rs1)) goto demote;
+            if(o->op != F_LI && o->op != F_ADDI && !STABLE(o->rs2)) goto demote;
+            switch(o->op) {
+                case F_ADD:  v[x] = v[o->rs1] + v[o->rs2]; break;
+                case F_ADDI: v[x] = v[o->rs1] + o->imm; break;
+                case F_SUB:  v[x] = v[o->rs1] - v[o->rs2]; break;
+                case F_SHL:  v[x] = v[o->rs1] << v[o->rs2]; break;
+                case F_AND:  v[x] = v[o->rs1] & v[o->rs2]; break;
+                case F_OR:   v[x] = v[o->rs1] | v[o->rs2]; break;
+                case F_XOR:  v[x] = v[o->rs1] ^ v[o->rs2]; break;
+                case F_LI:   v[x] = o->imm; break;
+                case F_EQ:   v[x] = v[o->rs1] == v[o->rs2]; break;
+                case F_LT:   v[x] = v[o->rs1] < v[o->rs2]; break;
+            }
+            set[x] = 1;
+        }
+    }
+    #undef STABLE
+
+    int c = bnz->rd, moving = 0;
+    //set to zero in the body, the loop ends after this iteration; to anything else, it never does
+    if(set[c] && !v[c]) goto demote;
+    for(int x = 0; x < 16; x++) if(accumulates[x] && value[x]) moving = 1;
+    uint32_t trips = accumulates[c] ? loop_trips(r[c], value[c]) : 0;
+    if(!trips && limit == INT64_MAX) {
+        //endless: a busy loop only ends on a budget, an idle one is as good as halted
+        if(moving) goto demote;
+        for(int x = 2; x < 16; x++) if(set[x]) r[x] = v[x];
+        return LOOP_HALT;
+    }
+    int64_t m = (limit - *cycle - 1) / length;
+    if(trips && trips <= m) m = trips;
+    if(!m) return LOOP_STEP;
+    for(int x = 2; x < 16; x++) {
+        if(accumulates[x]) r[x] += (uint16_t)(m & 0xFFFF) * (uint16_t)value[x];
+        else if(set[x]) r[x] = v[x];
+    }
+    *cycle += 1 + m * length;
+    return m == trips ? pc + 2 : start;
+
+demote:
+    bnz->op = bnz->rd == 1 ? F_BRA : F_BNZ;
+    return LOOP_STEP;
+}
+
+int interpret_fast(processor *p, struct jit *jit) {
+    uint32_t jit_enter(struct jit *j, processor *p, uint16_t pc, int64_t *cycle);
+    void jit_decoded(struct jit *j, uint16_t pc);
+    void jit_stored(struct jit *j, uint16_t addr);
+    static void *handlers[] = {
+        &&DECODE, &&NOP, &&ADD, &&ADDI, &&SUB, &&SHL, &&AND, &&OR, &&XOR, &&LW, &&SW,
+        &&LI, &&EQ, &&LT, &&BNZ, &&BRA, &&SPIN, &&JAL, &&BREAK, &&LOOP
+    };
+    p->registers[0] = 0;
+    p->registers[1] = -1;
+    p->jit = jit;
+    if(!p->ops) processor_decode(p);
+
+    decoded *ops = p->ops, *o;
+    int16_t *r = p->registers;
+    int16_t *mem = (int16_t*)p->memory;
+    uint8_t *dirty = p->dirty;
+    uint16_t pc = p->PC, a;
+    int16_t value;
+    int64_t cycle = p->cycle, resume = cycle;
+    int64_t limit = p->cycle_limit ? p->cycle_limit : INT64_MAX;
+
+    //a store to word a overwrites bytes 2a and 2a+1, which are covered by three instruction slots
+    #define INVALIDATE(a) if((a) < 0x8000) { ops[2 * (a)].op = F_DECODE; ops[2 * (a) + 1].op = F_DECODE; if(a) ops[2 * (a) - 1].op = F_DECODE; if((a) < p->instructions) p->ops_dirty = 1; if(jit) jit_stored(jit, a); }
+    #define DISPATCH() o = ops + pc; goto *handlers[o->op]
+    #define NEXT() pc += 2; cycle++; if(cycle >= limit) goto BUDGET; DISPATCH()
+    //block entries are where compiled code can take over
+    #define ENTER() if(jit) pc = jit_enter(jit, p, pc, &cycle); if(cycle >= limit) goto BUDGET; DISPATCH()
+
+    ENTER();
+
+    DECODE:
+        decode_instr(p, pc, o);
+        if(pc >= p->instructions * 2) p->ops_dirty = 1;
+        if(jit) jit_decoded(jit, pc);
+        goto *handlers[o->op];
+    BREAK:
+        if(p->stop_on_pause && cycle != resume && processor_paused(p, pc)) {
+            p->PC = pc;
+            p->cycle = cycle;
+            return STOP_BREAK;
+        }
+        for(breakpoint *bp = processor_breakpoint(p, pc); bp; bp = processor_next_breakpoint(p, bp))
+            interpret_debug_msg(p, bp->debug_msg);
+        goto *handlers[o->inner];
+    NOP:  NEXT();
+    ADD:  r[o->rd] = r[o->rs1] + r[o->rs2]; NEXT();
+    ADDI: r[o->rd] = r[o->rs1] + o->imm; NEXT();
+    SUB:  r[o->rd] = r[o->rs1] - r[o->rs2]; NEXT();
+    SHL:  r[o->rd] = r[o->rs1] << r[o->rs2]; NEXT();
+    AND:  r[o->rd] = r[o->rs1] & r[o->rs2]; NEXT();
+    OR:   r[o->rd] = r[o->rs1] | r[o->rs2]; NEXT();
+    XOR:  r[o->rd] = r[o->rs1] ^ r[o->rs2]; NEXT();
+    LI:   r[o->rd] = o->imm; NEXT();
+    EQ:   r[o->rd] = r[o->rs1] == r[o->rs2]; NEXT();
+    LT:   r[o->rd] = r[o->rs1] < r[o->rs2]; NEXT();
+    LW:
+        a = r[o->rs1] + o->imm;
+        if(p->io_pages[a >> 8]) {
+            p->PC = pc;
+            p->cycle = cycle;
+            int stop = bus_read(p, a, &value);
+            INVALIDATE(a);
+            if(o->rd > 1) r[o->rd] = value;
+            if(stop != STOP_NONE) return stop;
+            NEXT();
+        }
+        if(o->rd > 1) r[o->rd] = mem[a];
+        NEXT();
+    SW:
+        a = r[o->rs1] + o->imm;
+        mem[a] = r[o->rd];
+        dirty[a >> 7] = 1;
+        INVALIDATE(a);
+        if(p->io_pages[a >> 8]) {
+            p->PC = pc;
+            p->cycle = cycle;
+            int stop = bus_write(p, a, r[o->rd]);
+            if(stop != STOP_NONE) return stop;
+        }
+        NEXT();
+    BNZ:
+        if(!r[o->rd]) { pc += 2; cycle++; ENTER(); }
+    BRA:
+        pc += o->imm; cycle++; ENTER();
+    LOOP:
+        //a breakpoint on the bnz has to see every iteration
+        if(r[o->rd] && o->op == F_LOOP) {
+            int next = loop_forward(p, pc, &cycle, limit);
+            if(next == LOOP_HALT) {
+                p->PC = pc;
+                p->cycle = cycle + 1;
+                return STOP_HALT;
+            }
+            if(next != LOOP_STEP) {
+                pc = next;
+                ENTER();
+            }
+        }
+        goto BNZ;
+    SPIN:
+        if(!r[o->rd]) { NEXT(); }
+        //the halting instruction counts, as in interpret()
+        p->PC = pc;
+        p->cycle = cycle + 1;
+        return STOP_HALT;
+    JAL:
+        a = r[o->rs1] + o->imm;
+        if(o->rd > 1) r[o->rd] = pc + 2;
+        if(a == pc) {
+            p->PC = pc;
+            p->cycle = cycle + 1;
+            return STOP_HALT;
+        }
+        pc = a; cycle++; ENTER();
+    BUDGET:
+        p->PC = pc;
+        p->cycle = cycle;
+        return STOP_BUDGET;
+
+    #undef INVALIDATE
+    #undef DISPATCH
+    #undef NEXT
+    #undef ENTER
+}
+
+#pragma endregion
+
+//JIT
+#pragma region
+
+/*
+Hot basic blocks are compiled to x86-64. A block starts at a branch target and ends at bnz/jal,
+in front of a breakpoint, halting bnz or loop bnz (see loop_forward), or after JIT_MAX_BLOCK
+instructions. Compiled code keeps the architectural registers in processor.registers (rbx),
+addresses memory through r12 and the jit context through r13; stores mark processor.dirty through
+rbx as well. Every exit leaves with the next PC in eax; JIT_SIDE_EXIT marks an instruction the
+interpreter has to run itself (device and watchpoint accesses, a halting jal, stores into code).
+
+Chained exits check the cycle count against limit, a block short of the cycle budget, and leave
+once it is passed, so the interpreter can stop exactly on the budget.
+*/
+
+#define JIT_HOT 16
+#define JIT_COLD 0xFFFF
+#define JIT_MAX_BLOCK 64
+#define JIT_BUFFER (4 << 20)
+#define JIT_SIDE_EXIT 0x10000
+
+typedef struct jit_patch {
+    uint32_t at;
+    uint16_t target;
+} jit_patch;
+
+struct jit {
+    int64_t cycles;
+    int64_t limit;                   //compiled code leaves once cycles is past this
+    uint8_t *code[UINT16_MAX + 1];   //compiled block per entry PC
+    uint16_t heat[UINT16_MAX + 1];   //entries seen before compiling
+    uint8_t pages[512];              //256 byte pages holding code, devices or watchpoints, indexed by word address >> 7
+    uint8_t io[512];                 //pages holding devices or watchpoints, loads from them leave compiled code
+    uint8_t compiled[0x8000];        //words covered by compiled blocks
+    uint8_t *buf;
+    uint32_t used, epilogue, start;
+    jit_patch *patches;              //exits waiting for their target to be compiled
+    uint32_t patch_count;
+    uint32_t (*enter)(int16_t *registers, char *memory, jit *j, uint8_t *code);
+};
+
+#if defined(__x86_64__)
+
+void jit_emit(jit *j, uint8_t *bytes, int n) {
+    memcpy(j->buf + j->used, bytes, n);
+    j->used += n;
+}
+
+void jit_emit32(jit *j, uint32_t n) {
+    memcpy(j->buf + j->used, &n, 4);
+    j->used += 4;
+}
+
+void jit_rel32(jit *j, uint32_t at, uint32_t dest) {
+    int32_t rel = dest - (at + 4);
+    memcpy(j->buf + at, &rel, 4);
+}
+
+#define EMIT(...) jit_emit(j, (uint8_t[]){ __VA_ARGS__ }, sizeof((uint8_t[]){ __VA_ARGS__ }))
+
+void jit_flush(jit *j) {
+    memset(j->code, 0, sizeof(j->code));
+    memset(j->heat, 0, sizeof(j->heat));
+    memset(j->compiled, 0, sizeof(j->compiled));
+    j->patch_count = 0;
+    j->used = j->start;
+}
+
+jit *jit_new(processor *p) {
+    jit *j = calloc(1, sizeof(jit));
+    j->buf = mmap(0, JIT_BUFFER, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(j->buf == MAP_FAILED) {
+        free(j);
+        return 0;
+    }
+    j->patches = malloc(JIT_BUFFER / 16 * sizeof(jit_patch));
+    //enter: push rbx, r12, r13; rbx = registers; r12 = memory; r13 = j; jmp code
+    EMIT(0x53, 0x41, 0x54, 0x41, 0x55, 0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4, 0x49, 0x89, 0xD5, 0xFF, 0xE1);
+    //epilogue: pop r13, r12, rbx; ret
+    j->epilogue = j->used;
+    EMIT(0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3);
+    j->start = j->used;
+    j->enter = (void*)j->buf;
+    for(int pc = 0; pc < p->instructions * 2; pc += 256) j->pages[pc >> 8] = 1;
+    for(int i = 0; i < 512; i++) if(p->io_pages[i >> 1]) j->pages[i] = j->io[i] = 1;
+    return j;
+}
+
+void jit_free(jit *j) {
+    if(!j) return;
+    munmap(j->buf, JIT_BUFFER);
+    free(j->patches);
+    free(j);
+}
+
+void jit_decoded(jit *j, uint16_t pc) {
+    j->pages[pc >> 8] = 1;
+    j->pages[(uint16_t)(pc + 1) >> 8] = 1;
+}
+
+//the interpreter stored to word addr; compiled copies of it are now stale
+void jit_stored(jit *j, uint16_t addr) {
+    if(addr < 0x8000 && j->compiled[addr]) jit_flush(j);
+}
+
+void jit_add_cycles(jit *j, int count) {
+    if(!count) return;
+    //add qword [r13 + cycles], count
+    EMIT(0x49, 0x81, 0x85);
+    jit_emit32(j, offsetof(jit, cycles));
+    jit_emit32(j, count);
+}
+
+//leave for a statically known PC, chaining straight into its block once it is compiled
+void jit_exit(jit *j, uint16_t target, int count) {
+    jit_add_cycles(j, count);
+    EMIT(0x49, 0x8B, 0x85);                                      //mov rax, [r13 + limit]
+    jit_emit32(j, offsetof(jit, limit));
+    EMIT(0x49, 0x39, 0x85);                                      //cmp [r13 + cycles], rax
+    jit_emit32(j, offsetof(jit, cycles));
+    EMIT(0x0F, 0x8F);                                            //jg leave
+    uint32_t over = j->used;
+    jit_emit32(j, 0);
+    EMIT(0xE9);
+    uint32_t at = j->used;
+    jit_emit32(j, 0);
+    jit_rel32(j, over, j->used);
+    if(j->code[target]) jit_rel32(j, at, j->code[target] - j->buf);
+    else {
+        jit_rel32(j, at, j->used);
+        j->patches[j->patch_count++] = (jit_patch){ .at = at, .target = target };
+    }
+    //leave: eax = target; jmp epilogue
+    EMIT(0xB8);
+    jit_emit32(j, target);
+    EMIT(0xE9);
+    jit_emit32(j, 0);
+    jit_rel32(j, j->used - 4, j->epilogue);
+}
+
+uint8_t *jit_compile(jit *j, processor *p, uint16_t start) {
+    struct { uint32_t at; uint16_t pc; int count; } side[JIT_MAX_BLOCK * 2];
+    int sides = 0, count = 0;
+    if(j->used + JIT_MAX_BLOCK * 128 > JIT_BUFFER || j->patch_count + JIT_MAX_BLOCK * 2 > JIT_BUFFER / 16) jit_flush(j);
+    uint32_t entry = j->used;
+    uint16_t pc = start;
+
+    #define REG(n) (uint8_t)((n) * 2)
+    #define LOAD_EAX(n) EMIT(0x0F, 0xBF, 0x43, REG(n))        //movsx eax, word [rbx + n*2]
+    #define LOAD_ECX(n) EMIT(0x0F, 0xBF, 0x4B, REG(n))        //movsx ecx, word [rbx + n*2]
+    #define STORE_AX(n) EMIT(0x66, 0x89, 0x43, REG(n))        //mov word [rbx + n*2], ax
+    #define ADDRESS(o) LOAD_EAX(o->rs1); EMIT(0x05); jit_emit32(j, o->imm); EMIT(0x0F, 0xB7, 0xC0) //eax = (uint16_t)(rs1 + imm)
+    #define SIDE_EXIT(jcc) EMIT(0x0F, jcc); side[sides].at = j->used; side[sides].pc = pc; side[sides++].count = count; jit_emit32(j, 0)
+
+    while(1) {
+        decoded *o = p->ops + pc;
+        if(o->op == F_DECODE) {
+            decode_instr(p, pc, o);
+            jit_decoded(j, pc);
+        }
+        if(o->op == F_BREAK || o->op == F_SPIN || o->op == F_LOOP || count == JIT_MAX_BLOCK) {
+            if(!count) {
+                j->used = entry;
+                return 0;
+            }
+            jit_exit(j, pc, count);
+            break;
+        }
+        j->compiled[pc >> 1] = 1;
+        j->compiled[(uint16_t)(pc + 1) >> 1] = 1;
+        jit_decoded(j, pc);
+
+        int end = 0;
+        switch(o->op) {
+            case F_NOP: break;
+            case F_ADD: LOAD_EAX(o->rs1); LOAD_ECX(o->rs2); EMIT(0x01, 0xC8); STORE_AX(o->rd); break;
+            case F_SUB: LOAD_EAX(o->rs1); LOAD_ECX(o->rs2); EMIT(0x29, 0xC8); STORE_AX(o->rd); break;
+            case F_SHL: LOAD_EAX(o->rs1); LOAD_ECX(o->rs2); EMIT(0xD3, 0xE0); STORE_AX(o->rd); break;
+            case F_AND: LOAD_EAX(o->rs1); LOAD_ECX(o->rs2); EMIT(0x21, 0xC8); STORE_AX(o->rd); break;
+            case F_OR:  LOAD_EAX(o->rs1); LOAD_ECX(o->rs2); EMIT(0x09, 0xC8); STORE_AX(o->rd); break;
+            case F_XOR: LOAD_EAX(o->rs1); LOAD_ECX(o->rs2); EMIT(0x31, 0xC8); STORE_AX(o->rd); break;
+            case F_EQ:  LOAD_EAX(o->rs1); LOAD_ECX(o->rs2); EMIT(0x39, 0xC8, 0x0F, 0x94, 0xC0, 0x0F, 0xB6, 0xC0); STORE_AX(o->rd); break;
+            case F_LT:  LOAD_EAX(o->rs1); LOAD_ECX(o->rs2); EMIT(0x39, 0xC8, 0x0F, 0x9C, 0xC0, 0x0F, 0xB6, 0xC0); STORE_AX(o->rd); break;
+            case F_ADDI: LOAD_EAX(o->rs1); EMIT(0x05); jit_emit32(j, o->imm); STORE_AX(o->rd); break;
+            case F_LI: EMIT(0x66, 0xC7, 0x43, REG(o->rd), o->imm & 255, (uint16_t)o->imm >> 8); break;
+            case F_LW:
+                ADDRESS(o);
+                EMIT(0x89, 0xC1, 0xC1, 0xE9, 0x07);                      //mov ecx, eax; shr ecx, 7
+                EMIT(0x41, 0x80, 0xBC, 0x0D);                            //cmp byte [r13 + rcx + io], 0
+                jit_emit32(j, offsetof(jit, io));
+                EMIT(0x00);
+                SIDE_EXIT(0x85);
+                EMIT(0x41, 0x0F, 0xBF, 0x0C, 0x44);                      //movsx ecx, word [r12 + rax*2]
+                if(o->rd > 1) EMIT(0x66, 0x89, 0x4B, REG(o->rd));        //mov word [rbx + rd*2], cx
+                break;
+            case F_SW:
+                ADDRESS(o);
+                EMIT(0x89, 0xC1, 0xC1, 0xE9, 0x07);                      //mov ecx, eax; shr ecx, 7
+                EMIT(0x41, 0x80, 0xBC, 0x0D);                            //cmp byte [r13 + rcx + pages], 0
+                jit_emit32(j, offsetof(jit, pages));
+                EMIT(0x00);
+                SIDE_EXIT(0x85);
+                EMIT(0x0F, 0xB7, 0x53, REG(o->rd));                      //movzx edx, word [rbx + rd*2]
+                EMIT(0x66, 0x41, 0x89, 0x14, 0x44);                      //mov word [r12 + rax*2], dx
+                EMIT(0xC6, 0x84, 0x0B);                                  //mov byte [rbx + rcx + dirty], 1
+                jit_emit32(j, offsetof(processor, dirty) - offsetof(processor, registers));
+                EMIT(0x01);
+                break;
+            case F_BNZ: {
+                EMIT(0x66, 0x83, 0x7B, REG(o->rd), 0x00);                //cmp word [rbx + rd*2], 0
+                EMIT(0x0F, 0x85);                                        //jne taken
+                uint32_t taken = j->used;
+                jit_emit32(j, 0);
+                jit_exit(j, pc + 2, count + 1);
+                jit_rel32(j, taken, j->used);
+                jit_exit(j, pc + o->imm, count + 1);
+                end = 1;
+                break;
+            }
+            case F_BRA:
+                jit_exit(j, pc + o->imm, count + 1);
+                end = 1;
+                break;
+            case F_JAL:
+                ADDRESS(o);
+                EMIT(0x3D); jit_emit32(j, pc);                           //cmp eax, pc
+                SIDE_EXIT(0x84);
+                if(o->rd > 1) EMIT(0x66, 0xC7, 0x43, REG(o->rd), (pc + 2) & 255, (uint16_t)(pc + 2) >> 8);
+                jit_add_cycles(j, count + 1);
+                EMIT(0x49, 0x8B, 0x8D);                                  //mov rcx, [r13 + limit]
+                jit_emit32(j, offsetof(jit, limit));
+                EMIT(0x49, 0x39, 0x8D);                                  //cmp [r13 + cycles], rcx; jg epilogue
+                jit_emit32(j, offsetof(jit, cycles));
+                EMIT(0x0F, 0x8F);
+                jit_emit32(j, 0);
+                jit_rel32(j, j->used - 4, j->epilogue);
+                EMIT(0x49, 0x8B, 0x8C, 0xC5);                            //mov rcx, [r13 + rax*8 + code]
+                jit_emit32(j, offsetof(jit, code));
+                EMIT(0x48, 0x85, 0xC9, 0x0F, 0x84);                      //test rcx, rcx; jz epilogue
+                jit_emit32(j, 0);
+                jit_rel32(j, j->used - 4, j->epilogue);
+                EMIT(0xFF, 0xE1);                                        //jmp rcx
+                end = 1;
+                break;
+        }
+        count++;
+        if(end) break;
+        pc += 2;
+        if(pc == 0) {
+            jit_exit(j, pc, count);
+            break;
+        }
+    }
+
+    for(int i = 0; i < sides; i++) {
+        jit_rel32(j, side[i].at, j->used);
+        jit_add_cycles(j, side[i].count);
+        EMIT(0xB8);
+        jit_emit32(j, JIT_SIDE_EXIT | side[i].pc);
+        EMIT(0xE9);
+        jit_emit32(j, 0);
+        jit_rel32(j, j->used - 4, j->epilogue);
+    }
+
+    j->code[start] = j->buf + entry;
+    for(int i = 0; i < j->patch_count; i++) {
+        if(j->patches[i].target != start) continue;
+        jit_rel32(j, j->patches[i].at, entry);
+        j->patches[i--] = j->patches[--j->patch_count];
+    }
+    return j->code[start];
+
+    #undef REG
+    #undef LOAD_EAX
+    #undef LOAD_ECX
+    #undef STORE_AX
+    #undef ADDRESS
+    #undef SIDE_EXIT
+}
+
+#undef EMIT
+
+//runs compiled code from a block entry for as long as it can; returns the PC the interpreter resumes at
+uint32_t jit_enter(jit *j, processor *p, uint16_t pc, int64_t *cycle) {
+    //a block runs at most JIT_MAX_BLOCK cycles, so entering at or below limit cannot overshoot the budget
+    j->limit = (p->cycle_limit ? p->cycle_limit : INT64_MAX) - JIT_MAX_BLOCK;
+    while(1) {
+        if(*cycle > j->limit) return pc;
+        uint8_t *code = j->code[pc];
+        if(!code) {
+            if(j->heat[pc] == JIT_COLD || ++j->heat[pc] < JIT_HOT) return pc;
+            if(!(code = jit_compile(j, p, pc))) {
+                j->heat[pc] = JIT_COLD;
+                return pc;
+            }
+        }
+        j->cycles = *cycle;
+        uint32_t next = j->enter(p->registers, p->memory, j, code);
+        *cycle = j->cycles;
+        pc = next;
+        if(next & JIT_SIDE_EXIT) return pc;
+    }
+}
+
+#else
+
+jit *jit_new(processor *p) { return 0; }
+void jit_free(jit *j) {}
+void jit_flush(jit *j) {}
+void jit_decoded(jit *j, uint16_t pc) {}
+void jit_stored(jit *j, uint16_t addr) {}
+uint32_t jit_enter(jit *j, processor *p, uint16_t pc, int64_t *cycle) { return pc; }
+
+#endif
+
+#pragma endregion
+
+//BATCH
+#pragma region
+
+/*
+Runs one assembled program over many argument tuples. Each tuple fills a0-a2 and is also what the
+input port hands out. Jobs are split evenly between workers up front; a worker that runs out steals
+the back half of the remaining jobs of the busiest other worker. Results land in input order.
+*/
+
+typedef struct batch_job {
+    int16_t args[3];
+    int argn;
+    int stop;
+    int16_t output;
+    int64_t cycles;
+} batch_job;
+
+typedef struct batch_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int next, end; //jobs still owned by this worker
+    struct batch *batch;
+} batch_worker;
+
+typedef struct batch {
+    processor *image;
+    batch_job *jobs;
+    int job_count;
+    batch_worker *workers;
+    int worker_count;
+    int engine; //0 reference, 1 fast, 2 jit
+} batch;
+
+int batch_take(batch_worker *w) {
+    pthread_mutex_lock(&w->lock);
+    int job = w->next < w->end ? w->next++ : -1;
+    pthread_mutex_unlock(&w->lock);
+    return job;
+}
+
+//returns 0 once no other worker has jobs left
+int batch_steal(batch_worker *w) {
+    batch *b = w->batch;
+    batch_worker *victim = 0;
+    int most = 0;
+    for(int i = 0; i < b->worker_count; i++) {
+        batch_worker *v = b->workers + i;
+        if(v == w) continue;
+        pthread_mutex_lock(&v->lock);
+        int left = v->end - v->next;
+        pthread_mutex_unlock(&v->lock);
+        if(left > most) {
+            most = left;
+            victim = v;
+        }
+    }
+    if(!victim) return 0;
+
+    pthread_mutex_lock(&victim->lock);
+    int left = victim->end - victim->next;
+    int start = victim->end - (left + 1) / 2;
+    if(left > 0) victim->end = start;
+    pthread_mutex_unlock(&victim->lock);
+    if(left <= 0) return 1;
+
+    pthread_mutex_lock(&w->lock);
+    w->next = start;
+    w->end = start + (left + 1) / 2;
+    pthread_mutex_unlock(&w->lock);
+    return 1;
+}
+
+void *batch_run_worker(void *arg) {
+    batch_worker *w = arg;
+    batch *b = w->batch;
+    processor *p = processor_clone(b->image);
+    jit *j = b->engine == 2 ? jit_new(p) : 0;
+    p->out = 0;
+
+    while(1) {
+        int i = batch_take(w);
+        if(i < 0) {
+            if(batch_steal(w)) continue;
+            break;
+        }
+        batch_job *job = b->jobs + i;
+        if(p->ops_dirty && j) jit_flush(j);
+        processor_reset(p, b->image);
+        for(int k = 0; k < job->argn; k++) p->registers[k + 4] = job->args[k];
+        p->inputs = job->args;
+        p->input_count = job->argn;
+        job->stop = b->engine ? interpret_fast(p, j) : interpret(p, 0);
+        job->output = ((int16_t*)p->memory)[job->stop == STOP_EXIT ? DEVICE_EXIT : DEVICE_CONSOLE_OUT];
+        job->cycles = p->cycle;
+    }
+    jit_free(j);
+    processor_free(p);
+    return 0;
+}
+
+//spec is either a range lo..hi of single arguments or a file with up to 3 integers per line
+int batch_parse(char *spec, batch_job **jobs) {
+    int lo, hi, count = 0, n;
+    char end;
+    if(sscanf(spec, "%i..%i%c", &lo, &hi, &end) == 2) {
+        if(hi < lo) return 0;
+        *jobs = calloc(hi - lo + 1, sizeof(batch_job));
+        for(int i = lo; i <= hi; i++)
+            (*jobs)[count++] = (batch_job){ .args = { i }, .argn = 1 };
+        return count;
+    }
+    FILE *fp = fopen(spec, "r");
+    if(!fp) {
+        printf("No such file: %s\n", spec);
+        return -1;
+    }
+    char buf[512];
+    *jobs = malloc(4 * sizeof(batch_job));
+    for(int line = 1; fgets(buf, 512, fp); line++) {
+        batch_job job = { 0 };
+        int index = 0, value;
+        while(job.argn < 3 && sscanf(buf + index, "%i%n", &value, &n) == 1) {
+            job.args[job.argn++] = value;
+            index += n;
+        }
+        if(!job.argn) continue;
+        if(count > 3 && !((count - 1) & count))
+            *jobs = realloc(*jobs, count * 2 * sizeof(batch_job));
+        (*jobs)[count++] = job;
+    }
+    fclose(fp);
+    return count;
+}
+
+void batch_run(processor *image, batch_job *jobs, int job_count, int worker_count, int engine) {
+    if(worker_count > job_count) worker_count = job_count;
+    if(worker_count < 1) worker_count = 1;
+    if(engine) processor_decode(image);
+    batch b = { .image = image, .jobs = jobs, .job_count = job_count, .worker_count = worker_count, .engine = engine };
+    b.workers = calloc(worker_count, sizeof(batch_worker));
+    for(int i = 0; i < worker_count; i++) {
+        batch_worker *w = b.workers + i;
+        pthread_mutex_init(&w->lock, 0);
+        w->batch = &b;
+        w->next = (long)job_count * i / worker_count;
+        w->end = (long)job_count * (i + 1) / worker_count;
+    }
+    for(int i = 0; i < worker_count; i++)
+        pthread_create(&b.workers[i].thread, 0, batch_run_worker, b.workers + i);
+    for(int i = 0; i < worker_count; i++) {
+        pthread_join(b.workers[i].thread, 0);
+        pthread_mutex_destroy(&b.workers[i].lock);
+    }
+    free(b.workers);
+}
+
+#pragma endregion
+
+//LOCKSTEP
+#pragma region
+
+/*
+Runs batch jobs LANES at a time on one core. Registers are stored as 16 vectors of LANES int16_t
+lanes, so an ALU op is one vector op for every lane sitting at the same PC (vector extensions give
+AVX2 with -mavx2, SSE2 otherwise). Each step runs the lowest PC among live lanes with the other lanes
+masked off, which lets lanes that fell behind catch up again. Memory stays per lane in a processor
+clone; a lane left waiting for LOCKSTEP_PATIENCE steps, the last live lane, or a lane that writes into
+code finishes on the scalar fast path instead. Finished lanes are refilled with the next job.
+*/
+
+#ifdef __AVX2__
+#define LANES 16
+#else
+#define LANES 8
+#endif
+#define LOCKSTEP_PATIENCE 64
+#define LANE_EMPTY 0xFFFF    //PC of a lane without a job, above every real PC
+
+typedef int16_t lane_vec __attribute__((vector_size(LANES * sizeof(int16_t))));
+typedef uint16_t lane_pc __attribute__((vector_size(LANES * sizeof(uint16_t))));
+typedef int32_t lane_count __attribute__((vector_size(LANES * sizeof(int32_t))));
+
+typedef struct lockstep {
+    lane_vec r[16];
+    lane_pc pc;
+    lane_count cycles;          //folded into cycle_base before they can overflow
+    int64_t cycle_base[LANES];
+    lane_vec idle;
+    int job[LANES];
+    int live;
+    processor *p[LANES];
+    processor *image;
+    batch_job *jobs;
+    int job_count, next_job;
+} lockstep;
+
+void lockstep_load(lockstep *ls, int lane) {
+    if(ls->next_job == ls->job_count) {
+        ls->pc[lane] = LANE_EMPTY;
+        ls->live--;
+        return;
+    }
+    batch_job *job = ls->jobs + ls->next_job;
+    processor *p = ls->p[lane];
+    ls->job[lane] = ls->next_job++;
+    processor_reset(p, ls->image);
+    for(int k = 0; k < job->argn; k++) p->registers[k + 4] = job->args[k];
+    p->inputs = job->args;
+    p->input_count = job->argn;
+    for(int k = 0; k < 16; k++) ls->r[k][lane] = p->registers[k];
+    ls->pc[lane] = p->PC;
+    ls->cycles[lane] = 0;
+    ls->cycle_base[lane] = 0;
+    ls->idle[lane] = 0;
+}
+
+void lockstep_finish(lockstep *ls, int lane, int stop) {
+    batch_job *job = ls->jobs + ls->job[lane];
+    job->stop = stop;
+    job->output = ((int16_t*)ls->p[lane]->memory)[stop == STOP_EXIT ? DEVICE_EXIT : DEVICE_CONSOLE_OUT];
+    job->cycles = ls->cycle_base[lane] + ls->cycles[lane];
+    lockstep_load(ls, lane);
+}
+
+//hands a lane to the scalar interpreter and runs its job to the end
+void lockstep_scalar(lockstep *ls, int lane) {
+    processor *p = ls->p[lane];
+    for(int k = 0; k < 16; k++) p->registers[k] = ls->r[k][lane];
+    p->PC = ls->pc[lane];
+    p->cycle = ls->cycle_base[lane] + ls->cycles[lane];
+    int stop = interpret_fast(p, 0);
+    ls->cycle_base[lane] = p->cycle;
+    ls->cycles[lane] = 0;
+    lockstep_finish(ls, lane, stop);
+}
+
+void lockstep_run(processor *image, batch_job *jobs, int job_count) {
+    lockstep *ls = aligned_alloc(64, sizeof(lockstep));
+    memset(ls, 0, sizeof(lockstep));
+    ls->image = image;
+    ls->jobs = jobs;
+    ls->job_count = job_count;
+    ls->live = LANES;
+    processor_decode(image);
+    for(int l = 0; l < LANES; l++) {
+        ls->p[l] = processor_clone(image);
+        ls->p[l]->out = 0;
+        lockstep_load(ls, l);
+    }
+    lane_vec *r = ls->r;
+
+    while(ls->live) {
+        if(ls->live == 1) {
+            for(int l = 0; l < LANES; l++) if(ls->pc[l] != LANE_EMPTY) { lockstep_scalar(ls, l); break; }
+            continue;
+        }
+
+        //flipping the top bit turns the unsigned minimum into a signed one, which SSE2 has
+        lane_vec key = (lane_vec)(ls->pc ^ 0x8000);
+        int16_t min = INT16_MAX;
+        for(int l = 0; l < LANES; l++) min = key[l] < min ? key[l] : min;
+        uint16_t pc = min ^ 0x8000;
+        lane_vec m = (lane_vec)(ls->pc == pc);
+        lane_vec one = m & 1;
+        ls->idle = (ls->idle + 1) & ~m;
+
+        //past the program the code is whatever each lane stored there
+        if(pc >= image->instructions * 2) {
+            for(int l = 0; l < LANES; l++) if(m[l]) lockstep_scalar(ls, l);
+            continue;
+        }
+
+        decoded *o = image->ops + pc;
+        if(o->op == F_DECODE) decode_instr(image, pc, o);
+        int op = o->op == F_BREAK ? o->inner : o->op;
+
+        #define BLEND(rd, v) r[rd] = (r[rd] & ~m) | ((v) & m)
+        #define EACH_LANE for(int l = 0; l < LANES; l++) if(m[l])
+        switch(op) {
+            case F_NOP: break;
+            case F_ADD:  BLEND(o->rd, r[o->rs1] + r[o->rs2]); break;
+            case F_ADDI: BLEND(o->rd, r[o->rs1] + o->imm); break;
+            case F_SUB:  BLEND(o->rd, r[o->rs1] - r[o->rs2]); break;
+            case F_AND:  BLEND(o->rd, r[o->rs1] & r[o->rs2]); break;
+            case F_OR:   BLEND(o->rd, r[o->rs1] | r[o->rs2]); break;
+            case F_XOR:  BLEND(o->rd, r[o->rs1] ^ r[o->rs2]); break;
+            case F_EQ:   BLEND(o->rd, (r[o->rs1] == r[o->rs2]) & 1); break;
+            case F_LT:   BLEND(o->rd, (r[o->rs1] < r[o->rs2]) & 1); break;
+            case F_LI:   BLEND(o->rd, (lane_vec){ 0 } + o->imm); break;
+            case F_SHL:  //no 16 bit variable shift before AVX-512
+                EACH_LANE r[o->rd][l] = r[o->rs1][l] << r[o->rs2][l];
+                break;
+            case F_LW:
+                EACH_LANE {
+                    processor *p = ls->p[l];
+                    uint16_t a = r[o->rs1][l] + o->imm;
+                    int16_t value = ((int16_t*)p->memory)[a];
+                    int stop = STOP_NONE;
+                    if(p->io_pages[a >> 8]) {
+                        p->PC = ls->pc[l];
+                        p->cycle = ls->cycle_base[l] + ls->cycles[l];
+                        stop = bus_read(p, a, &value);
+                    }
+                    if(o->rd > 1) r[o->rd][l] = value;
+                    if(stop != STOP_NONE) {
+                        lockstep_finish(ls, l, stop);
+                        m[l] = one[l] = 0;
+                    }
+                }
+                break;
+            case F_SW:
+                EACH_LANE {
+                    processor *p = ls->p[l];
+                    uint16_t a = r[o->rs1][l] + o->imm;
+                    ((int16_t*)p->memory)[a] = r[o->rd][l];
+                    p->dirty[a >> 7] = 1;
+                    int stop = STOP_NONE;
+                    if(p->io_pages[a >> 8]) {
+                        p->PC = ls->pc[l];
+                        p->cycle = ls->cycle_base[l] + ls->cycles[l];
+                        stop = bus_write(p, a, r[o->rd][l]);
+                    }
+                    if(stop != STOP_NONE) {
+                        lockstep_finish(ls, l, stop);
+                        m[l] = one[l] = 0;
+                    } else if(a < image->instructions || p->ops_dirty) {
+                        //this lane's code no longer matches the shared decode
+                        ls->pc[l] += 2;
+                        ls->cycles[l]++;
+                        lockstep_scalar(ls, l);
+                        m[l] = one[l] = 0;
+                    }
+                }
+                break;
+            case F_SPIN:
+            case F_BNZ:
+            case F_BRA:
+            case F_LOOP: {
+                lane_vec taken = r[o->rd] != 0;
+                if(op == F_SPIN) {
+                    lane_vec halt = m & taken;
+                    for(int l = 0; l < LANES; l++) if(halt[l]) {
+                        ls->cycles[l]++;
+                        lockstep_finish(ls, l, STOP_HALT);
+                        m[l] = one[l] = 0;
+                    }
+                }
+                ls->pc += (lane_pc)(m & ((taken & o->imm) | (~taken & 2)));
+                ls->cycles += __builtin_convertvector(one, lane_count);
+                goto diverged;
+            }
+            case F_JAL:
+                EACH_LANE {
+                    uint16_t target = r[o->rs1][l] + o->imm;
+                    if(o->rd > 1) r[o->rd][l] = pc + 2;
+                    if(target == pc) {
+                        ls->cycles[l]++;
+                        lockstep_finish(ls, l, STOP_HALT);
+                        continue;
+                    }
+                    ls->pc[l] = target;
+                    ls->cycles[l]++;
+                }
+                goto diverged;
+        }
+        #undef BLEND
+        #undef EACH_LANE
+        ls->pc += (lane_pc)(m & 2);
+        ls->cycles += __builtin_convertvector(one, lane_count);
+        continue;
+
+        //lanes only split up at control flow, so that is where stragglers are looked for
+        diverged:
+        for(int l = 0; l < LANES; l++) {
+            if(ls->idle[l] > LOCKSTEP_PATIENCE && ls->pc[l] != LANE_EMPTY) lockstep_scalar(ls, l);
+            if(ls->cycles[l] > 1 << 30) {
+                ls->cycle_base[l] += ls->cycles[l];
+                ls->cycles[l] = 0;
+            }
+        }
+    }
+
+    for(int l = 0; l < LANES; l++) processor_free(ls->p[l]);
+    free(ls);
+}
+
+#pragma endregion
+
+//TRANSLATOR
+#pragma region
+
+//emits the program as standalone C: one statement per instruction, labels as goto targets
+void translate(processor *p, FILE *fp, char *source) {
+    void fprint_instruction(FILE *fp, uint16_t instr);
+    //only emit the helpers the program needs so the output compiles cleanly with -Wall
+    int uses_input = 0, uses_memory = 0, uses_dispatch = 0;
+    char *is_target = calloc(p->instructions + 1, 1);
+    is_target[0] = 1;
+    for(int i = 0; i < p->instructions; i++) {
+        uint16_t instr = ((uint16_t*)p->memory)[i];
+        uint16_t target = i * 2 + (bits(7, 0) << 24 >> 24);
+        if(bits(15, 12) == 8) uses_input = uses_memory = 1;
+        if(bits(15, 12) == 9) uses_memory = 1;
+        if(bits(15, 12) == 15) uses_dispatch = 1;
+        if(bits(15, 12) != 14 || !bits(11, 8) || target == i * 2) continue;
+        if(target & 1 || target >= p->instructions * 2) uses_dispatch = 1;
+        else is_target[target / 2] = 1;
+    }
+    fprintf(fp, "//generated from %s by ./interpret -c\n", source);
+    fprintf(fp, "#include <stdio.h>\n#include <stdint.h>\n#include <stdlib.h>\n\n");
+    fprintf(fp, "static uint16_t memory[UINT16_MAX + 1] = {");
+    for(int i = 0; i < p->instructions; i++)
+        fprintf(fp, "%s0x%04X,", i % 12 ? " " : "\n    ", ((uint16_t*)p->memory)[i]);
+    fprintf(fp, "\n};\n\n");
+
+    if(uses_input) {
+        fprintf(fp, "static void input(void) {\n");
+        fprintf(fp, "    int i = 0;\n");
+        fprintf(fp, "    printf(\"input: \");\n");
+        fprintf(fp, "    fscanf(stdin, \"%%i\", &i);\n");
+        fprintf(fp, "    memory[0x400] = i;\n");
+        fprintf(fp, "}\n\n");
+    }
+
+    fprintf(fp, "int main(int argc, char **argv) {\n");
+    fprintf(fp, "    int16_t r[16] = { [1] = -1, [3] = 0x7FFF };\n");
+    fprintf(fp, "    long long cycle = 0;\n");
+    if(uses_memory) fprintf(fp, "    uint16_t a;\n");
+    if(uses_dispatch) fprintf(fp, "    uint16_t pc;\n");
+    fprintf(fp, "    for(int i = 1; i < argc && i < 4; i++) r[i + 3] = strtol(argv[i], 0, 0);\n");
+    fprintf(fp, "    goto L_0000;\n\n");
+
+    //jal targets are only known at runtime
+    if(uses_dispatch) {
+        fprintf(fp, "dispatch:\n");
+        fprintf(fp, "    switch(pc) {\n");
+        for(int i = 0; i < p->instructions; i++)
+            fprintf(fp, "        case 0x%04X: goto L_%04X;\n", i * 2, i * 2);
+        fprintf(fp, "    }\n");
+        fprintf(fp, "    printf(\"jump outside program: 0x%%04X\\n\", pc);\n");
+        fprintf(fp, "    return 1;\n\n");
+    }
+
+    for(int i = 0; i < p->instructions; i++) {
+        uint16_t pc = i * 2;
+        uint16_t instr = ((uint16_t*)p->memory)[i];
+        int opcode = bits(15, 12), rd = bits(11, 8), rs1 = bits(7, 4), rs2 = bits(3, 0);
+        int imm4 = (bits(3, 0) << 28 >> 28), imm8 = (bits(7, 0) << 24 >> 24);
+        for(int l = 0; l < p->label_count; l++)
+            if(p->labels[l].pc == pc) fprintf(fp, "//%s\n", p->labels[l].name);
+        if(uses_dispatch || is_target[i]) fprintf(fp, "L_%04X: ", pc);
+        fprintf(fp, "//");
+        fprint_instruction(fp, instr);
+        fprintf(fp, "\n");
+
+        for(breakpoint *bp = processor_breakpoint(p, pc); bp; bp = processor_next_breakpoint(p, bp)) {
+            char *str = bp->debug_msg;
+            if(!str) continue;
+            fprintf(fp, "    printf(\"");
+            for(char *c = str + 1 + str[0]; *c; c++) {
+                if(*c == '"' || *c == '\\') fprintf(fp, "\\%c", *c);
+                else if(*c < ' ' || *c > '~') fprintf(fp, "\\%03o", (unsigned char)*c);
+                else fputc(*c, fp);
+            }
+            fprintf(fp, "\\n\"");
+            for(int n = 0; n < str[0]; n++) fprintf(fp, ", r[%d]", str[n + 1]);
+            fprintf(fp, ");\n");
+        }
+
+        char *op = 0;
+        switch(opcode) {
+            case 0:  op = "+";  break;
+            case 3:  op = "-";  break;
+            case 4:  op = "<<"; break;
+            case 5:  op = "&";  break;
+            case 6:  op = "|";  break;
+            case 7:  op = "^";  break;
+            case 12: op = "=="; break;
+            case 13: op = "<";  break;
+        }
+        //shift counts wrap at 32 like the interpreter's x86 shift, which keeps the C well defined
+        if(op && rd > 1 && opcode == 4) fprintf(fp, "    r[%d] = r[%d] << (r[%d] & 31);\n", rd, rs1, rs2);
+        else if(op && rd > 1) fprintf(fp, "    r[%d] = r[%d] %s r[%d];\n", rd, rs1, op, rs2);
+        if((opcode == 1 || opcode == 2) && rd > 1) fprintf(fp, "    r[%d] = r[%d] + %d;\n", rd, opcode == 1 ? rs1 : rd, opcode == 1 ? imm4 : imm8);
+        if((opcode == 10 || opcode == 11) && rd > 1) fprintf(fp, "    r[%d] = %d;\n", rd, (int16_t)(opcode == 10 ? imm8 : imm8 << 8));
+        if(opcode == 8) {
+            fprintf(fp, "    a = r[%d] + %d;\n", rs1, imm4);
+            fprintf(fp, "    if(a == 0x400) input();\n");
+            if(rd > 1) fprintf(fp, "    r[%d] = memory[a];\n", rd);
+        }
+        if(opcode == 9) {
+            fprintf(fp, "    a = r[%d] + %d;\n", rs1, imm4);
+            fprintf(fp, "    memory[a] = r[%d];\n", rd);
+            fprintf(fp, "    if(a == 0x402) {\n");
+            fprintf(fp, "        printf(\"%%i\\ncycles: %%lld\\n\", (int16_t)memory[0x402], cycle);\n");
+            fprintf(fp, "        return 0;\n");
+            fprintf(fp, "    }\n");
+        }
+        if(opcode == 14 && rd != 0) {
+            uint16_t target = pc + imm8;
+            char *cond = rd == 1 ? "" : "    if(r[%d]) ";
+            fprintf(fp, cond, rd);
+            if(rd != 1) fprintf(fp, "{\n    ");
+            if(target == pc) fprintf(fp, "    return 0;\n");
+            else if(target & 1 || target >= p->instructions * 2) fprintf(fp, "    cycle++; pc = 0x%04X; goto dispatch;\n", target);
+            else fprintf(fp, "    cycle++; goto L_%04X;\n", target);
+            if(rd != 1) fprintf(fp, "    }\n");
+        }
+        if(opcode == 15) {
+            fprintf(fp, "    pc = r[%d] + %d;\n", rs1, imm4);
+            if(rd > 1) fprintf(fp, "    r[%d] = 0x%04X;\n", rd, pc + 2);
+            fprintf(fp, "    if(pc == 0x%04X) return 0;\n", pc);
+            fprintf(fp, "    cycle++; goto dispatch;\n");
+        } else if(!(opcode == 14 && rd == 1)) {
+            fprintf(fp, "    cycle++;\n");
+        }
+    }
+    //past the end the reference runs through zeroed memory, which decodes as no-ops, and wraps to 0
+    fprintf(fp, "    cycle += 0x%04X;\n", 0x8000 - p->instructions);
+    fprintf(fp, "    goto L_0000;\n");
+    fprintf(fp, "}\n");
+    free(is_target);
+}
+
+#pragma endregion
+
+//OBJECT
+#pragma region
+
+/*
+Binary object files hold an assembled program so it can be started without parsing. Layout:
+header, label table, breakpoint table, watchpoint table, string pool, then the code image at a
+page aligned offset, zero padded to a page boundary. Loading maps the code pages copy-on-write straight into processor
+memory and points label names and debug messages into the mapped string pool.
+
+Debug messages keep their in-memory layout: register count, the registers, then the format string.
+*/
+
+#define OBJECT_MAGIC "IOBJ"
+#define OBJECT_VERSION 2
+#define OBJECT_ALIGN 4096
+#define OBJECT_NONE 0xFFFFFFFF //string offset of a pause
+
+typedef struct object_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t instructions;
+    uint32_t label_count;
+    uint32_t labels;            //file offsets
+    uint32_t breakpoint_count;
+    uint32_t breakpoints;
+    uint32_t strings;
+    uint32_t code;
+    uint32_t watch_count;
+    uint32_t watches;
+} object_header;
+
+typedef struct object_symbol {
+    uint16_t pc;
+    uint16_t pad;
+    uint32_t string;            //offset into the string pool
+} object_symbol;
+
+typedef struct object_watch {
+    uint16_t addr, count;
+    uint8_t kinds;
+    uint8_t pad[3];
+    uint32_t string;            //OBJECT_NONE for a watchpoint that stops
+} object_watch;
+
+int object_is(FILE *fp) {
+    char magic[4] = { 0 };
+    int n = fread(magic, 1, 4, fp);
+    rewind(fp);
+    return n == 4 && !memcmp(magic, OBJECT_MAGIC, 4);
+}
+
+int object_msg_size(char *msg) {
+    return 1 + msg[0] + strlen(msg + 1 + msg[0]) + 1;
+}
+
+void processor_save_object(processor *p, FILE *fp) {
+    object_header h = { .magic = OBJECT_MAGIC, .version = OBJECT_VERSION, .instructions = p->instructions };
+    h.label_count = p->label_count;
+    h.labels = sizeof(h);
+    h.breakpoint_count = p->breakpoint_count;
+    h.breakpoints = h.labels + h.label_count * sizeof(object_symbol);
+    h.watch_count = p->watch_count;
+    h.watches = h.breakpoints + h.breakpoint_count * sizeof(object_symbol);
+    h.strings = h.watches + h.watch_count * sizeof(object_watch);
+
+    uint32_t size = 0;
+    fseek(fp, h.labels, SEEK_SET);
+    for(int i = 0; i < p->label_count; i++) {
+        object_symbol s = { .pc = p->labels[i].pc, .string = size };
+        size += strlen(p->labels[i].name) + 1;
+        fwrite(&s, sizeof(s), 1, fp);
+    }
+    fseek(fp, h.breakpoints, SEEK_SET);
+    for(int i = 0; i < p->breakpoint_count; i++) {
+        char *msg = p->breakpoints[i].debug_msg;
+        object_symbol s = { .pc = p->breakpoints[i].pc, .string = msg ? size : OBJECT_NONE };
+        if(msg) size += object_msg_size(msg);
+        fwrite(&s, sizeof(s), 1, fp);
+    }
+    for(watchpoint *w = p->watchpoints; w < p->watchpoints + p->watch_count; w++) {
+        object_watch ow = { .addr = w->addr, .count = w->count, .kinds = w->kinds, .string = w->debug_msg ? size : OBJECT_NONE };
+        if(w->debug_msg) size += object_msg_size(w->debug_msg);
+        fwrite(&ow, sizeof(ow), 1, fp);
+    }
+    for(int i = 0; i < p->label_count; i++)
+        fwrite(p->labels[i].name, strlen(p->labels[i].name) + 1, 1, fp);
+    for(int i = 0; i < p->breakpoint_count; i++)
+        if(p->breakpoints[i].debug_msg) fwrite(p->breakpoints[i].debug_msg, object_msg_size(p->breakpoints[i].debug_msg), 1, fp);
+    for(watchpoint *w = p->watchpoints; w < p->watchpoints + p->watch_count; w++)
+        if(w->debug_msg) fwrite(w->debug_msg, object_msg_size(w->debug_msg), 1, fp);
+
+    h.code = (h.strings + size + OBJECT_ALIGN - 1) / OBJECT_ALIGN * OBJECT_ALIGN;
+    int code_size = (p->instructions * 2 + OBJECT_ALIGN - 1) / OBJECT_ALIGN * OBJECT_ALIGN;
+    fseek(fp, h.code, SEEK_SET);
+    fwrite(p->memory, code_size, 1, fp);
+    rewind(fp);
+    fwrite(&h, sizeof(h), 1, fp);
+}
+
+//loads an object file written by processor_save_object, returns the number of errors like processor_load
+int processor_map_object(processor *p, char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0 || st.st_size < sizeof(object_header)) {
+        printf("Cannot read object file %s\n", path);
+        if(fd >= 0) close(fd);
+        return 1;
+    }
+    char *base = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    object_header *h = (object_header*)base;
+    int code_size = h->instructions * 2;
+    if(base == MAP_FAILED || h->version != OBJECT_VERSION || h->code + code_size > st.st_size
+        || h->strings > st.st_size || h->watches + h->watch_count * sizeof(object_watch) > h->strings
+        || h->breakpoints + h->breakpoint_count * sizeof(object_symbol) > h->watches
+        || h->labels + h->label_count * sizeof(object_symbol) > h->breakpoints) {
+        printf("Malformed object file %s\n", path);
+        if(base != MAP_FAILED) munmap(base, st.st_size);
+        close(fd);
+        return 1;
+    }
+
+    //code pages are mapped over the start of memory; writes to them stay private to this process
+    long page = sysconf(_SC_PAGESIZE);
+    int pages = (code_size + page - 1) / page * page;
+    int mapped = code_size && h->code % page == 0 && h->code + pages <= st.st_size
+        && mmap(p->memory, pages, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, h->code) != MAP_FAILED;
+    if(!mapped) memcpy(p->memory, base + h->code, code_size);
+    close(fd);
+    p->object = base;
+    p->object_size = st.st_size;
+    p->instructions = h->instructions;
+
+    object_symbol *labels = (object_symbol*)(base + h->labels);
+    for(int i = 0; i < h->label_count; i++)
+        processor_add_label(p, labels[i].pc, base + h->strings + labels[i].string);
+
+    object_symbol *bps = (object_symbol*)(base + h->breakpoints);
+    for(int i = 0; i < h->breakpoint_count; i++)
+        processor_add_breakpoint(p, bps[i].pc, bps[i].string == OBJECT_NONE ? 0 : base + h->strings + bps[i].string);
+
+    object_watch *watches = (object_watch*)(base + h->watches);
+    for(int i = 0; i < h->watch_count; i++)
+        processor_add_watchpoint(p, watches[i].addr, watches[i].count, watches[i].kinds,
+            watches[i].string == OBJECT_NONE ? 0 : base + h->strings + watches[i].string);
+    p->PC = 0;
+    return 0;
+}
+
+#pragma endregion
+
+//OPTIMIZER
+#pragma region
+
+/*
+Peephole pass over an assembled image, run by -O between loading and everything else. Label
+addresses loaded with li are followed through moves into the jal that uses them, so every jump
+edge is known. A label whose address is used any other way is an entry with unknown registers, as
+is pc 0. The pass gives up on programs it cannot follow: jumps to computed addresses, lw/sw of
+constant addresses inside the code, running off the end of the code.
+
+Registers are tracked as constants through the whole program, with what a call writes taken from
+the returns of its callee. A register write of the value the register already holds is dropped,
+which takes care of li x15, F before every jal ra, x15+0 when nothing in between touched x15. Moves
+(add rd, rs, x0 and the like) are propagated within a block, writes nobody reads are dropped, bnz
+is threaded through unconditional branches and code no path reaches is dropped. Everything behind a
+removed instruction moves up; labels, label immediates, branch offsets and debug/pause pcs follow.
+*/
+
+enum { OPT_TOP, OPT_CONST, OPT_VARY };
+enum { OPT_UNKNOWN = -1, OPT_RETURN = -2 };
+
+#define OPT_ALL 0xFFFC  //every register but x0 and x1
+#define OPT_ROUNDS 64
+
+typedef struct opt_value {
+    uint8_t kind;
+    int16_t value;
+    int16_t tag;        //label the value is the address of, -1 if a plain number
+} opt_value;
+
+typedef struct optimizer {
+    processor *p;
+    int n;
+    uint16_t *code;
+    int *ref;           //label index the immediate was resolved from, -1 if none
+    uint8_t *entry;     //entered with unknown registers
+    uint8_t *escaped;   //per label, its address is used for more than jumping to it
+    int escapes;
+    uint8_t *reached;
+    uint8_t *deleted;
+    int *target;        //jal target index, OPT_UNKNOWN or OPT_RETURN
+    uint16_t *clobber;  //per call target, registers the call can write
+    opt_value (*summary)[16];   //per call target, registers at its returns
+    opt_value (*in)[16];
+    int redundant, moves, dead, branches, unreachable, rewritten;
+} optimizer;
+
+opt_value optimize_get(opt_value *regs, int r) {
+    if(r == 0) return (opt_value){ OPT_CONST, 0, -1 };
+    if(r == 1) return (opt_value){ OPT_CONST, -1, -1 };
+    return regs[r];
+}
+
+//applies instruction i to the registers
+void optimize_transfer(optimizer *o, int i, opt_value *regs) {
+    uint16_t instr = o->code[i];
+    int opcode = bits(15, 12), rd = bits(11, 8);
+    int mem_read, use_imm, use_rd, reg_write;
+    int16_t ALU_op, imm = 0, out;
+    interpret_control(o->p, opcode, &mem_read, &ALU_op, &use_imm, &use_rd, &reg_write);
+    interpret_imm_gen(o->p, instr, &imm);
+    if(!reg_write || rd <= 1) return;
+
+    opt_value a = optimize_get(regs, use_rd ? rd : bits(7, 4));
+    opt_value b = use_imm ? (opt_value){ OPT_CONST, imm, -1 } : optimize_get(regs, bits(3, 0));
+    if(ALU_op == 8 || ALU_op == 9) a = (opt_value){ OPT_CONST, 0, -1 };
+    opt_value r = { OPT_VARY, 0, -1 };
+    if(opcode == 8 || opcode == 15 || (o->ref[i] >= 0 && opcode != 10)) {
+        r.kind = OPT_VARY;
+    } else if(opcode == 10 && o->ref[i] >= 0) {
+        r = (opt_value){ OPT_CONST, imm, o->ref[i] };
+    } else if(a.kind == OPT_TOP || b.kind == OPT_TOP) {
+        r.kind = OPT_TOP;
+    } else if(a.kind == OPT_CONST && b.kind == OPT_CONST) {
+        //label addresses move, so they only survive being copied
+        if(a.tag >= 0 && b.tag < 0 && !b.value && ALU_op == 0) r = a;
+        else if(b.tag >= 0 && a.tag < 0 && !a.value && (ALU_op == 0 || ALU_op == 8)) r = b;
+        else if(a.tag < 0 && b.tag < 0) {
+            interpret_ALU(o->p, ALU_op, a.value, b.value, &out);
+            r = (opt_value){ OPT_CONST, out, -1 };
+        }
+    }
+    regs[rd] = r;
+}
+
+//successor indexes of instruction i, -1 if it can jump out of the code; running off the end stops
+//like a device would
+int optimize_successors(optimizer *o, int i, int *succ) {
+    uint16_t instr = o->code[i];
+    int opcode = bits(15, 12), rd = bits(11, 8), count = 0;
+    if(o->deleted[i]) {
+        succ[count++] = i + 1;
+    } else if(opcode == 14) {
+        int offset = (int8_t)bits(7, 0);
+        if(offset & 1) return -1;
+        if(rd != 1) succ[count++] = i + 1;
+        if(rd != 0) succ[count++] = i + offset / 2;
+    } else if(opcode == 15) {
+        if(o->target[i] >= 0) succ[count++] = o->target[i];
+        if(rd != 0) succ[count++] = i + 1;
+    } else {
+        succ[count++] = i + 1;
+    }
+    for(int k = 0; k < count; k++) {
+        if(succ[k] < 0 || succ[k] > o->n) return -1;
+        if(succ[k] == o->n) succ[k--] = succ[--count];
+    }
+    return count;
+}
+
+int optimize_meet(opt_value *dst, opt_value *src) {
+    int changed = 0;
+    for(int r = 2; r < 16; r++) {
+        opt_value d = dst[r], s = src[r];
+        if(s.kind == OPT_TOP || d.kind == OPT_VARY) continue;
+        if(d.kind == OPT_TOP) dst[r] = s;
+        else if(s.kind == OPT_VARY || s.value != d.value || s.tag != d.tag) dst[r].kind = OPT_VARY;
+        else continue;
+        changed = 1;
+    }
+    return changed;
+}
+
+//constant registers at every reached instruction, given the clobber sets
+void optimize_propagate(optimizer *o) {
+    int n = o->n, top = 0, succ[2];
+    int *work = malloc(n * sizeof(int));
+    uint8_t *queued = calloc(n, 1);
+    memset(o->in, 0, n * sizeof(*o->in));
+    memset(o->reached, 0, n);
+    for(int i = 0; i < n; i++) {
+        if(!o->entry[i]) continue;
+        for(int r = 2; r < 16; r++) o->in[i][r].kind = OPT_VARY;
+        o->reached[i] = queued[i] = 1;
+        work[top++] = i;
+    }
+    while(top) {
+        int i = work[--top];
+        queued[i] = 0;
+        opt_value out[16], call[16];
+        memcpy(out, o->in[i], sizeof(out));
+        optimize_transfer(o, i, out);
+        int count = optimize_successors(o, i, succ);
+        for(int k = 0; k < count; k++) {
+            opt_value *edge = out;
+            uint16_t instr = o->code[i];
+            if(bits(15, 12) == 15 && bits(11, 8) && succ[k] == i + 1) {
+                //back from the call with whatever the callee writes, nothing comes back from calls
+                //that are not known yet
+                int t = o->target[i];
+                if(t < 0) continue;
+                memcpy(call, out, sizeof(call));
+                for(int r = 2; r < 16; r++) if(o->clobber[t] >> r & 1) call[r] = o->summary[t][r];
+                call[bits(11, 8)].kind = OPT_VARY;
+                edge = call;
+            }
+            int s = succ[k];
+            for(int r = 2; r < 16 && o->entry[s]; r++) {
+                int tag = edge[r].kind == OPT_CONST ? edge[r].tag : -1;
+                if(tag >= 0 && !o->escaped[tag]) o->escaped[tag] = ++o->escapes;
+            }
+            if(optimize_meet(o->in[s], edge) || !o->reached[s]) {
+                o->reached[s] = 1;
+                if(!queued[s]) work[top++] = s;
+                queued[s] = 1;
+            }
+        }
+    }
+    free(work);
+    free(queued);
+}
+
+//jal targets from the constants, returns how many changed
+int optimize_targets(optimizer *o) {
+    int changed = 0;
+    for(int i = 0; i < o->n; i++) {
+        uint16_t instr = o->code[i];
+        if(bits(15, 12) != 15 || !o->reached[i]) continue;
+        int target = OPT_UNKNOWN;
+        opt_value base = optimize_get(o->in[i], bits(7, 4));
+        if(base.kind == OPT_CONST && base.tag >= 0 && !bits(3, 0)) target = o->p->labels[base.tag].pc >> 1;
+        else if(!bits(11, 8) && bits(7, 4) == 2 && !bits(3, 0)) target = OPT_RETURN;
+        if(target >= o->n) target = OPT_UNKNOWN;
+        changed += target != o->target[i];
+        o->target[i] = target;
+    }
+    return changed;
+}
+
+//registers each call target can write, through the calls it makes, and what they hold when it
+//returns, returns how many changed
+int optimize_clobbers(optimizer *o) {
+    int n = o->n, succ[2], changed = 0, edge_count = 0, top;
+    uint16_t *direct = calloc(n, sizeof(uint16_t)), *result = calloc(n, sizeof(uint16_t));
+    uint8_t *function = calloc(n, 1);
+    int *seen = calloc(n, sizeof(int)), *work = malloc(n * sizeof(int));
+    int (*edges)[2] = malloc(n * sizeof(*edges));
+    for(int i = 0; i < n; i++) {
+        uint16_t instr = o->code[i];
+        if(o->reached[i] && bits(15, 12) == 15 && bits(11, 8) && o->target[i] >= 0) function[o->target[i]] = 1;
+    }
+
+    //the body of a function is what it reaches before returning
+    for(int f = 0; f < n; f++) {
+        if(!function[f]) continue;
+        top = 0;
+        work[top++] = f;
+        seen[f] = f + 1;
+        opt_value summary[16];
+        memset(summary, 0, sizeof(summary));
+        while(top) {
+            int i = work[--top];
+            uint16_t instr = o->code[i];
+            int opcode = bits(15, 12), rd = bits(11, 8);
+            if(opcode == 15 && o->target[i] == OPT_RETURN) optimize_meet(summary, o->in[i]);
+            if(opcode != 9 && opcode != 14 && rd > 1) direct[f] |= 1 << rd;
+            if(opcode == 15 && o->target[i] == OPT_UNKNOWN) direct[f] = OPT_ALL;
+            if(opcode == 15 && rd && o->target[i] >= 0) {
+                edges[edge_count][0] = f;
+                edges[edge_count++][1] = o->target[i];
+                if(edge_count == n) {
+                    direct[f] = OPT_ALL;
+                    edge_count--;
+                }
+            }
+            int count = optimize_successors(o, i, succ);
+            if(count < 0) direct[f] = OPT_ALL;
+            for(int k = 0; k < count; k++) {
+                int s = opcode == 15 && rd && succ[k] != i + 1 ? -1 : succ[k];
+                if(s < 0 || seen[s] == f + 1) continue;
+                seen[s] = f + 1;
+                work[top++] = s;
+            }
+        }
+        for(int r = 2; r < 16; r++) {
+            opt_value old = o->summary[f][r];
+            changed += old.kind != summary[r].kind || old.value != summary[r].value || old.tag != summary[r].tag;
+            o->summary[f][r] = summary[r];
+        }
+    }
+    memcpy(result, direct, n * sizeof(uint16_t));
+    for(int again = 1; again; ) {
+        again = 0;
+        for(int e = 0; e < edge_count; e++) {
+            uint16_t merged = result[edges[e][0]] | result[edges[e][1]];
+            again |= merged != result[edges[e][0]];
+            result[edges[e][0]] = merged;
+        }
+    }
+    for(int f = 0; f < n; f++) {
+        uint16_t c = function[f] ? result[f] : OPT_ALL;
+        changed += c != o->clobber[f];
+        o->clobber[f] = c;
+    }
+    free(direct);
+    free(result);
+    free(function);
+    free(seen);
+    free(work);
+    free(edges);
+    return changed;
+}
+
+//why the program cannot be rearranged, 0 if it can
+char *optimize_check(optimizer *o) {
+    int succ[2];
+    for(int i = 0; i < o->n; i++) {
+        if(!o->reached[i]) continue;
+        uint16_t instr = o->code[i];
+        int opcode = bits(15, 12);
+        if(optimize_successors(o, i, succ) < 0) return "control leaves the code";
+        if(opcode == 15 && o->target[i] == OPT_UNKNOWN) return "jal to a computed address";
+        opt_value base = optimize_get(o->in[i], bits(7, 4));
+        int16_t imm;
+        interpret_imm_gen(o->p, instr, &imm);
+        if((opcode == 8 || opcode == 9) && base.kind == OPT_CONST && (base.tag >= 0 || (uint16_t)(base.value + imm) < o->n))
+            return "lw/sw inside the code";
+    }
+    return 0;
+}
+
+//label addresses read by anything but a jal or a move, returns how many more escaped
+int optimize_escapes(optimizer *o) {
+    uint16_t optimize_uses(uint16_t instr);
+    int optimize_move_source(uint16_t instr);
+    int escapes = 0;
+    for(int i = 0; i < o->n; i++) {
+        uint16_t instr = o->code[i];
+        if(!o->reached[i] || (bits(15, 12) == 15 && !bits(3, 0)) || optimize_move_source(instr) >= 0) continue;
+        uint16_t uses = optimize_uses(instr);
+        for(int r = 2; r < 16; r++) {
+            opt_value v = o->in[i][r];
+            if(!(uses >> r & 1) || v.kind != OPT_CONST || v.tag < 0 || o->escaped[v.tag]) continue;
+            o->escaped[v.tag] = 1;
+            escapes++;
+        }
+    }
+    return escapes;
+}
+
+//registers instruction i reads
+uint16_t optimize_uses(uint16_t instr) {
+    switch(bits(15, 12)) {
+        case 1: case 8: case 15: return 1 << bits(7, 4);
+        case 2: case 14:         return 1 << bits(11, 8);
+        case 9:                  return 1 << bits(7, 4) | 1 << bits(11, 8);
+        case 10: case 11:        return 0;
+        default:                 return 1 << bits(7, 4) | 1 << bits(3, 0);
+    }
+}
+
+//source of a register to register move, -1 if instr is something else
+int optimize_move_source(uint16_t instr) {
+    int opcode = bits(15, 12), rs1 = bits(7, 4), rs2 = bits(3, 0);
+    if((opcode == 0 || opcode == 6 || opcode == 7) && !rs1) return rs2;
+    if((opcode == 0 || opcode == 3 || opcode == 4 || opcode == 6 || opcode == 7) && !rs2) return rs1;
+    if(opcode == 1 && !rs2) return rs1;
+    return -1;
+}
+
+int optimize_pure(uint16_t instr) {
+    int opcode = bits(15, 12);
+    return opcode != 8 && opcode != 9 && opcode != 14 && opcode != 15;
+}
+
+//first instruction left at or after i
+int optimize_next(optimizer *o, int i) {
+    while(i < o->n && o->deleted[i]) i++;
+    return i;
+}
+
+//writes of values the register already holds
+void optimize_redundant(optimizer *o) {
+    for(int i = 0; i < o->n; i++) {
+        uint16_t instr = o->code[i];
+        int rd = bits(11, 8);
+        if(!o->reached[i] || !optimize_pure(instr)) continue;
+        opt_value out[16];
+        memcpy(out, o->in[i], sizeof(out));
+        optimize_transfer(o, i, out);
+        opt_value before = o->in[i][rd], after = out[rd];
+        if(rd > 1 && (before.kind != OPT_CONST || after.kind != OPT_CONST || before.value != after.value || before.tag != after.tag))
+            continue;
+        o->deleted[i] = 1;
+        o->redundant++;
+    }
+}
+
+//reads through move chains within a block, and moves of what the register already holds
+void optimize_moves(optimizer *o) {
+    int n = o->n, succ[2];
+    uint8_t *leader = calloc(n + 1, 1);
+    for(int l = 0; l < o->p->label_count; l++) leader[o->p->labels[l].pc >> 1] = 1;
+    for(int i = 0; i < n; i++) {
+        uint16_t instr = o->code[i];
+        if(o->entry[i]) leader[i] = 1;
+        if(!o->reached[i] || bits(15, 12) < 14) continue;
+        leader[i + 1] = 1;
+        int count = optimize_successors(o, i, succ);
+        for(int k = 0; k < count; k++) leader[succ[k]] = 1;
+    }
+
+    int copy[16];
+    for(int i = 0; i < n; i++) {
+        if(leader[i] || !o->reached[i]) for(int r = 0; r < 16; r++) copy[r] = r;
+        if(!o->reached[i] || o->deleted[i]) continue;
+        uint16_t instr = o->code[i];
+        int opcode = bits(15, 12), rd = bits(11, 8), rs1 = bits(7, 4), rs2 = bits(3, 0);
+        if(opcode != 15) {
+            int rd_read = opcode == 9 || opcode == 14;
+            int rs1_read = (opcode < 10 && opcode != 2) || opcode == 12 || opcode == 13;
+            int rs2_read = opcode == 0 || (opcode >= 3 && opcode <= 7) || opcode == 12 || opcode == 13;
+            uint16_t rewritten = instr & 0xF000;
+            rewritten |= (rd_read ? copy[rd] : rd) << 8;
+            rewritten |= (rs1_read ? copy[rs1] : rs1) << 4;
+            rewritten |= rs2_read ? copy[rs2] : rs2;
+            if(rewritten != instr) {
+                o->code[i] = instr = rewritten;
+                o->rewritten++;
+            }
+        }
+        int source = optimize_move_source(instr);
+        if(source >= 0 && rd > 1 && (source == rd || copy[rd] == source)) {
+            o->deleted[i] = 1;
+            o->moves++;
+            continue;
+        }
+        if(opcode == 9 || opcode == 14 || rd <= 1) continue;
+        copy[rd] = rd;
+        for(int r = 2; r < 16; r++) if(copy[r] == rd) copy[r] = r;
+        if(source >= 0) copy[rd] = source;
+    }
+    free(leader);
+}
+
+//settles bnz on constants, retargets it past unconditional branches and drops branches that go
+//nowhere, returns how many changed
+int optimize_branches(optimizer *o) {
+    int changed = o->branches;
+    for(int i = 0; i < o->n; i++) {
+        uint16_t instr = o->code[i];
+        if(!o->reached[i] || o->deleted[i] || bits(15, 12) != 14) continue;
+        int rd = bits(11, 8), target = i + (int8_t)bits(7, 0) / 2;
+        opt_value v = optimize_get(o->in[i], rd);
+        if(rd > 1 && v.kind == OPT_CONST) {
+            rd = v.value != 0;
+            o->code[i] = instr = (instr & 0xF0FF) | rd << 8;
+            o->rewritten++;
+        }
+        for(int hops = 0; hops < 8 && target != i; hops++) {
+            int at = optimize_next(o, target);
+            if(at == o->n) break;
+            uint16_t next = o->code[at];
+            int next_target = at + (int8_t)(next & 0xFF) / 2;
+            if(next >> 12 != 14 || !((next >> 8 & 15) == 1 || (next >> 8 & 15) == rd) || next_target == at) break;
+            if(2 * (next_target - i) < -128 || 2 * (next_target - i) > 127) break;
+            target = next_target;
+            o->code[i] = instr = (instr & 0xFF00) | ((2 * (target - i)) & 0xFF);
+            o->ref[i] = -1;
+            o->branches++;
+        }
+        if(!rd || (target != i && optimize_next(o, target) == optimize_next(o, i + 1))) {
+            o->deleted[i] = 1;
+            o->branches++;
+        }
+    }
+    return o->branches - changed;
+}
+
+//drops what can no longer be reached, returns how many went
+int optimize_unreachable(optimizer *o) {
+    int n = o->n, top = 0, succ[2], dropped = 0;
+    int *work = malloc(n * sizeof(int));
+    memset(o->reached, 0, n);
+    for(int i = 0; i < n; i++)
+        if(o->entry[i]) o->reached[work[top++] = i] = 1;
+    while(top) {
+        int i = work[--top];
+        int count = optimize_successors(o, i, succ);
+        for(int k = 0; k < count; k++)
+            if(!o->reached[succ[k]]) o->reached[work[top++] = succ[k]] = 1;
+    }
+    for(int i = 0; i < n; i++) {
+        if(o->reached[i] || o->deleted[i]) continue;
+        o->deleted[i] = 1;
+        o->unreachable++;
+        dropped++;
+    }
+    free(work);
+    return dropped;
+}
+
+//register writes no path reads before the next write
+void optimize_dead(optimizer *o) {
+    int n = o->n, succ[2];
+    uint16_t *live = calloc(n + 1, sizeof(uint16_t)), *out = calloc(n, sizeof(uint16_t));
+    for(int deleted = 1; deleted; ) {
+        for(int again = 1; again; ) {
+            again = 0;
+            for(int i = n - 1; i >= 0; i--) {
+                if(!o->reached[i]) continue;
+                uint16_t instr = o->code[i], in;
+                int opcode = bits(15, 12), rd = bits(11, 8);
+                int count = optimize_successors(o, i, succ);
+                out[i] = 0;
+                for(int k = 0; k < count; k++) out[i] |= live[succ[k]];
+
+                //calls, returns, halts and the end hand every register to code not looked at here
+                int target = opcode == 14 ? i + (int8_t)bits(7, 0) / 2 : -1;
+                if(!o->deleted[i] && (opcode == 15 || target == i || target == n)) out[i] = OPT_ALL;
+                if(i + 1 == n) out[i] = OPT_ALL;
+                in = out[i];
+                if(!o->deleted[i]) {
+                    if(opcode != 9 && opcode != 14) in &= ~(1 << rd);
+                    in |= optimize_uses(instr);
+                }
+                if(o->p->bp_index[i]) in = OPT_ALL;
+                in &= OPT_ALL;
+                again |= in != live[i];
+                live[i] = in;
+            }
+        }
+        deleted = 0;
+        for(int i = 0; i < n; i++) {
+            uint16_t instr = o->code[i];
+            int rd = bits(11, 8);
+            if(!o->reached[i] || o->deleted[i] || !optimize_pure(instr) || rd <= 1 || out[i] >> rd & 1) continue;
+            o->deleted[i] = 1;
+            o->dead++;
+            deleted = 1;
+        }
+    }
+    free(live);
+    free(out);
+}
+
+//rewrites the image without the deleted instructions, returns how many went
+int optimize_relocate(optimizer *o) {
+    processor *p = o->p;
+    int n = o->n, kept = 0;
+    int *map = malloc((n + 1) * sizeof(int));
+    for(int i = 0; i <= n; i++) {
+        map[i] = kept;
+        if(i < n && !o->deleted[i]) kept++;
+    }
+
+    for(int i = 0; i < n; i++) {
+        uint16_t instr = o->code[i];
+        if(o->deleted[i]) continue;
+        if(bits(15, 12) == 14) {
+            int offset = 2 * (map[i + (int8_t)bits(7, 0) / 2] - map[i]);
+            instr = (instr & 0xFF00) | (offset & 0xFF);
+        } else if(o->ref[i] >= 0) {
+            instr = (instr & 0xFF00) | ((2 * map[p->labels[o->ref[i]].pc >> 1]) & 0xFF);
+        }
+        ((uint16_t*)p->memory)[map[i]] = instr;
+    }
+    memset(p->memory + 2 * kept, 0, 2 * (n - kept));
+
+    int refs = 0;
+    for(int r = 0; r < p->label_ref_count; r++) {
+        int i = p->label_refs[r].pc >> 1;
+        if(o->deleted[i] || o->ref[i] < 0) {
+            free(p->label_refs[r].name);
+            continue;
+        }
+        p->label_refs[refs] = p->label_refs[r];
+        p->label_refs[refs++].pc = 2 * map[i];
+    }
+    p->label_ref_count = refs;
+    for(int l = 0; l < p->label_count; l++) p->labels[l].pc = 2 * map[p->labels[l].pc >> 1];
+
+    //messages move to the instruction that now follows them, unless nothing reaches it
+    int count = p->breakpoint_count;
+    p->breakpoint_count = 0;
+    memset(p->bp_index, 0, 0x8000 * sizeof(uint16_t));
+    breakpoint *old = malloc(count * sizeof(breakpoint) + 1);
+    memcpy(old, p->breakpoints, count * sizeof(breakpoint));
+    for(int b = 0; b < count; b++) {
+        int i = old[b].pc >> 1;
+        if(i < n && !o->reached[i]) free(old[b].debug_msg);
+        else processor_add_breakpoint(p, 2 * map[i < n ? i : n], old[b].debug_msg);
+    }
+    free(old);
+
+    p->PC = 2 * map[p->PC >> 1];
+    p->instructions = kept;
+    if(p->ops) memset(p->ops, 0, (UINT16_MAX + 1) * sizeof(decoded));
+    free(map);
+    return n - kept;
+}
+
+//returns the number of instructions removed, report goes to log if set
+int processor_optimize(processor *p, FILE *log) {
+    if(p->object) {
+        if(log) fprintf(log, "optimizer: object files carry no label references, skipped\n");
+        return 0;
+    }
+    int n = p->instructions;
+    if(!n) return 0;
+    optimizer o = { .p = p, .n = n };
+    o.code = malloc(n * sizeof(uint16_t));
+    memcpy(o.code, p->memory, n * sizeof(uint16_t));
+    o.ref = malloc(n * sizeof(int));
+    o.entry = calloc(n, 1);
+    o.reached = calloc(n, 1);
+    o.deleted = calloc(n, 1);
+    o.target = malloc(n * sizeof(int));
+    o.clobber = malloc(n * sizeof(uint16_t));
+    o.summary = malloc(n * sizeof(*o.summary));
+    o.in = malloc(n * sizeof(*o.in));
+    o.escaped = calloc(p->label_count + 1, 1);
+    for(int i = 0; i < n; i++) o.ref[i] = -1;
+    for(int r = 0; r < p->label_ref_count; r++) {
+        int i = p->label_refs[r].pc >> 1;
+        label *l = processor_find_label(p, p->label_refs[r].name);
+        o.ref[i] = l - p->labels;
+        if(o.code[i] >> 12 != 14 && o.code[i] >> 12 != 10) o.escaped[o.ref[i]] = 1;
+    }
+
+    //escaped labels can be jumped to from anywhere; each escape starts the analysis over
+    int rounds;
+    do {
+        memset(o.entry, 0, n);
+        o.entry[p->PC >> 1] = 1;
+        for(int l = 0; l < p->label_count; l++)
+            if(o.escaped[l] && p->labels[l].pc >> 1 < n) o.entry[p->labels[l].pc >> 1] = 1;
+        for(int i = 0; i < n; i++) {
+            o.target[i] = OPT_UNKNOWN;
+            o.clobber[i] = OPT_ALL;
+            for(int r = 0; r < 16; r++) o.summary[i][r] = (opt_value){ OPT_TOP, 0, -1 };
+        }
+        o.escapes = 0;
+
+        //return summaries start out unknown, so recursive calls can keep their constants; only a
+        //settled result is safe to use
+        for(rounds = 0; rounds < OPT_ROUNDS; rounds++) {
+            optimize_propagate(&o);
+            if(!(optimize_targets(&o) + optimize_clobbers(&o))) break;
+        }
+    } while(rounds < OPT_ROUNDS && o.escapes + optimize_escapes(&o));
+
+    int removed = 0;
+    char *reason = rounds < OPT_ROUNDS ? optimize_check(&o) : "analysis did not settle";
+    if(reason) {
+        if(log) fprintf(log, "optimizer: %s, skipped\n", reason);
+    } else {
+        optimize_redundant(&o);
+        optimize_moves(&o);
+        while(optimize_branches(&o) + optimize_unreachable(&o));
+        optimize_dead(&o);
+        removed = optimize_relocate(&o);
+        if(log) fprintf(log, "optimizer: %d of %d instructions removed (%d redundant, %d moves, %d dead, %d branches, "
+            "%d unreachable), %d rewritten\n", removed, n, o.redundant, o.moves, o.dead, o.branches, o.unreachable, o.rewritten);
+    }
+    free(o.code);
+    free(o.ref);
+    free(o.entry);
+    free(o.reached);
+    free(o.deleted);
+    free(o.target);
+    free(o.clobber);
+    free(o.summary);
+    free(o.escaped);
+    free(o.in);
+    return removed;
+}
+
+#pragma endregion
+
+//LIBRARY
+#pragma region
+
+/*
+What interpret.h adds on top of the processor functions above. processor_run picks the engine and
+keeps one JIT per processor across runs; the CLI calls the engines directly instead.
+*/
+
+int processor_load_file(processor *p, char *path) {
+    FILE *fp = fopen(path, "r");
+    if(!fp) return -1;
+    int errors = object_is(fp) ? processor_map_object(p, path) : processor_load(p, fp);
+    fclose(fp);
+    return errors;
+}
+
+void processor_load_image(processor *p, uint16_t *code, int count) {
+    if(count > 0x8000) count = 0x8000;
+    memcpy(p->memory, code, count * sizeof(uint16_t));
+    p->instructions = count;
+    p->PC = 0;
+    if(p->ops) memset(p->ops, 0, (UINT16_MAX + 1) * sizeof(decoded));
+    //the JIT sized its code pages to the old program
+    jit_free(p->run_jit);
+    p->run_jit = 0;
+}
+
+void processor_set_engine(processor *p, int engine) {
+    p->engine = engine;
+}
+
+void processor_set_inputs(processor *p, int16_t *inputs, int count) {
+    p->inputs = inputs;
+    p->input_count = count;
+}
+
+void processor_set_output(processor *p, FILE *out) {
+    p->out = out;
+}
+
+int processor_run(processor *p, int64_t max_cycles) {
+    p->cycle_limit = max_cycles > 0 ? p->cycle + max_cycles : 0;
+    p->stop_on_pause = 1;
+    if(p->engine == ENGINE_JIT && !p->run_jit) p->run_jit = jit_new(p);
+    int stop = p->engine == ENGINE_REFERENCE ? interpret(p, 0) : interpret_fast(p, p->engine == ENGINE_JIT ? p->run_jit : 0);
+    p->cycle_limit = 0;
+    p->stop_on_pause = 0;
+    //engines stop on the lw or sw itself; step past it so the next run does not access it again
+    if(stop == STOP_OUTPUT || stop == STOP_EXIT || stop == STOP_WATCH) {
+        p->PC += 2;
+        p->cycle++;
+    }
+    return stop;
+}
+
+int16_t processor_get_register(processor *p, int n) {
+    return p->registers[n & 15];
+}
+
+void processor_set_register(processor *p, int n, int16_t value) {
+    if((n & 15) > 1) p->registers[n & 15] = value;
+}
+
+uint16_t processor_get_pc(processor *p) {
+    return p->PC;
+}
+
+void processor_set_pc(processor *p, uint16_t pc) {
+    p->PC = pc;
+}
+
+int64_t processor_get_cycles(processor *p) {
+    return p->cycle;
+}
+
+int16_t processor_read(processor *p, uint16_t addr) {
+    return ((int16_t*)p->memory)[addr];
+}
+
+void processor_write(processor *p, uint16_t addr, int16_t value) {
+    ((int16_t*)p->memory)[addr] = value;
+    processor_stored(p, addr);
+}
+
+#pragma endregion
+
+//HARTS
+#pragma region
+
+/*
+-H <count> runs count harts on as many host threads. Every hart is a clone of the loaded program
+with its own registers, PC and cycle count, but they all share hart 0's memory. Hart i starts with
+sp lowered by i * HART_STACK words so the stacks do not overlap. Code is decoded and compiled per
+hart, so a store into code is only seen by the hart that made it.
+
+Hart device, from DEVICE_HART on:
++0  id          lw reads the hart number
++1  count       lw reads the number of harts
++2  address     sw sets the word the atomic operations act on, per hart
++3  swap        sw exchanges the value with the word atomically, lw reads the old value
++4  fetch-add   sw adds the value to the word atomically, lw reads the old value
++5  barrier     sw waits until every hart still running has arrived
+
+Console output does not stop a hart; outputs are collected per hart. A hart is done once it halts,
+writes the exit device or stops on a watchpoint, and leaves the barrier count then. The run ends when every hart is done
+and exits with the code of hart 0, if it wrote one.
+*/
+
+#define HART_MAX 64
+#define HART_STACK 0x100
+
+typedef struct hart_result {
+    processor *p;
+    pthread_t thread;
+    int stop;
+    int16_t exit;
+    int16_t *outputs;
+    int output_count, output_cap;
+} hart_result;
+
+struct harts {
+    int count;
+    hart_result *results;
+    pthread_mutex_t lock;
+    pthread_cond_t arrived;
+    int live, waiting;
+    int generation;             //barriers passed, waiters sleep until it changes
+};
+
+//everyone waiting is released once all live harts have arrived
+void harts_release(harts *m) {
+    if(!m->waiting || m->waiting < m->live) return;
+    m->waiting = 0;
+    m->generation++;
+    pthread_cond_broadcast(&m->arrived);
+}
+
+void harts_barrier(harts *m) {
+    pthread_mutex_lock(&m->lock);
+    int generation = m->generation;
+    m->waiting++;
+    harts_release(m);
+    while(generation == m->generation) pthread_cond_wait(&m->arrived, &m->lock);
+    pthread_mutex_unlock(&m->lock);
+}
+
+void harts_leave(harts *m) {
+    pthread_mutex_lock(&m->lock);
+    m->live--;
+    harts_release(m);
+    pthread_mutex_unlock(&m->lock);
+}
+
+int16_t hart_read(processor *p, uint16_t a) {
+    switch(a - DEVICE_HART) {
+        case 0: return p->hart;
+        case 1: return p->harts->count;
+        case 2: return p->atomic_addr;
+        case 3:
+        case 4: return p->atomic_old;
+    }
+    return 0;
+}
+
+int hart_write(processor *p, uint16_t a, int16_t value) {
+    int16_t *word = (int16_t*)p->memory + p->atomic_addr;
+    switch(a - DEVICE_HART) {
+        case 2: p->atomic_addr = value; break;
+        case 3:
+            p->atomic_old = __atomic_exchange_n(word, value, __ATOMIC_SEQ_CST);
+            processor_stored(p, p->atomic_addr);
+            break;
+        case 4:
+            p->atomic_old = __atomic_fetch_add(word, value, __ATOMIC_SEQ_CST);
+            processor_stored(p, p->atomic_addr);
+            break;
+        case 5: harts_barrier(p->harts); break;
+    }
+    return STOP_NONE;
+}
+
+//console output and exit take the value from the sw, the shared word may already be another hart's
+int hart_output(processor *p, uint16_t a, int16_t value) {
+    hart_result *h = p->harts->results + p->hart;
+    if(h->output_count == h->output_cap) {
+        h->output_cap = h->output_cap ? h->output_cap * 2 : 16;
+        h->outputs = realloc(h->outputs, h->output_cap * sizeof(int16_t));
+    }
+    h->outputs[h->output_count++] = value;
+    return STOP_NONE;
+}
+
+int hart_exit(processor *p, uint16_t a, int16_t value) {
+    p->harts->results[p->hart].exit = value;
+    return STOP_EXIT;
+}
+
+void *harts_run_hart(void *arg) {
+    hart_result *h = arg;
+    do h->stop = processor_run(h->p, 0);
+    while(h->stop == STOP_BREAK);
+    harts_leave(h->p->harts);
+    return 0;
+}
+
+//prints one line per hart: outputs, how it stopped and its cycles; returns the exit code of hart 0
+int harts_run(processor *image, int count, int engine) {
+    if(count < 1 || count > HART_MAX) {
+        printf("Hart count must be 1..%d\n", HART_MAX);
+        return -1;
+    }
+    hart_result *h = calloc(count, sizeof(hart_result));
+    harts m = { .count = count, .results = h, .live = count };
+    pthread_mutex_init(&m.lock, 0);
+    pthread_cond_init(&m.arrived, 0);
+    for(int i = 0; i < count; i++) {
+        processor *p = h[i].p = processor_clone(image);
+        if(i) {
+            munmap(p->memory, MEMORY_SIZE);
+            p->memory = h[0].p->memory;
+            p->shared_memory = 1;
+        }
+        p->harts = &m;
+        p->hart = i;
+        p->registers[3] -= i * HART_STACK;
+        processor_set_engine(p, engine);
+        processor_attach(p, (device){ DEVICE_HART, 6, hart_read, hart_write });
+        for(device *d = p->devices; d < p->devices + p->device_count; d++) {
+            if(d->base == DEVICE_CONSOLE_OUT) d->write = hart_output;
+            if(d->base == DEVICE_EXIT) d->write = hart_exit;
+        }
+    }
+    for(int i = 0; i < count; i++) pthread_create(&h[i].thread, 0, harts_run_hart, h + i);
+    for(int i = 0; i < count; i++) pthread_join(h[i].thread, 0);
+
+    for(int i = 0; i < count; i++) {
+        printf("hart %d\t", i);
+        for(int k = 0; k < h[i].output_count; k++) printf(k ? " %i" : "%i", h[i].outputs[k]);
+        if(!h[i].output_count) printf("-");
+        if(h[i].stop == STOP_EXIT) printf("\texit %i", h[i].exit);
+        else if(h[i].stop == STOP_WATCH) printf("\twatch 0x%04X", h[i].p->watch_addr);
+        else printf("\thalt");
+        printf("\t%lld\n", (long long)processor_get_cycles(h[i].p));
+        free(h[i].outputs);
+    }
+    int code = h[0].stop == STOP_EXIT ? h[0].exit : 0;
+    //hart 0 owns the memory, so it goes last
+    for(int i = count - 1; i >= 0; i--) processor_free(h[i].p);
+    free(h);
+    pthread_mutex_destroy(&m.lock);
+    pthread_cond_destroy(&m.arrived);
+    return code;
+}
+
+#pragma endregion
+
+//SERVER
+#pragma region
+
+/*
+Daemon mode: -S <socket> listens on a Unix domain socket and runs programs for clients. Assembled
+images are cached by a 64 bit FNV-1a hash of their source, so a client sends a program once and
+refers to it by hash afterwards. Each worker thread accepts a connection and answers its requests
+in order; it keeps a clone of the image it ran last and only resets it when the next request is for
+the same program.
+
+Requests are one line, optionally followed by the program source:
+    run program=<bytes> | hash=<hex> [args=a0,a1,a2] [input=v,...] [budget=cycles] [engine=ref|fast|jit]
+Responses are one line:
+    <halt|exit|budget> cycles=<n> hash=<hex> [exit=<code>] output=<v,...>
+    error <message>
+Console outputs are collected and the run continues, pauses and watchpoints are skipped. Cycles count
+every instruction run, including the final sw to the exit device. A budget of 0 means none.
+*/
+
+#define SERVER_BUDGET (1LL << 32)
+#define SERVER_MAX_PROGRAM (1 << 20)
+#define SERVER_MIN_IMAGES 64
+
+typedef struct server_image {
+    uint64_t hash;
+    processor *p;       //0 if the slot is free
+    char *source;
+    size_t size;
+    int users;          //workers holding a clone, the image is only evicted at 0
+    int64_t used;       //request number of the last use
+} server_image;
+
+typedef struct server {
+    int fd;
+    pthread_mutex_t lock;
+    server_image *images;
+    int image_count;
+    int64_t requests;
+} server;
+
+typedef struct server_worker {
+    pthread_t thread;
+    server *s;
+    server_image *image;    //whose clone p is
+    processor *p;
+    int16_t *inputs, *outputs;
+    int input_cap, output_cap;
+} server_worker;
+
+uint64_t server_hash(char *data, size_t size) {
+    uint64_t h = 14695981039346656037ull;
+    for(size_t i = 0; i < size; i++) h = (h ^ (uint8_t)data[i]) * 1099511628211ull;
+    return h;
+}
+
+//finds or assembles the image and holds it for the caller; source is 0 for a lookup by hash
+server_image *server_acquire(server *s, uint64_t hash, char *source, size_t size, char **error) {
+    pthread_mutex_lock(&s->lock);
+    for(server_image *im = s->images; im < s->images + s->image_count; im++) {
+        if(!im->p || im->hash != hash) continue;
+        if(source && (im->size != size || memcmp(im->source, source, size))) continue;
+        im->users++;
+        im->used = ++s->requests;
+        pthread_mutex_unlock(&s->lock);
+        return im;
+    }
+    pthread_mutex_unlock(&s->lock);
+    if(!source) {
+        *error = "unknown hash, send the program";
+        return 0;
+    }
+
+    processor *p = processor_new();
+    p->out = 0;
+    FILE *fp = fmemopen(source, size, "r");
+    int errors = fp ? processor_load(p, fp) : 1;
+    if(fp) fclose(fp);
+    if(errors) {
+        processor_free(p);
+        *error = "assembly failed";
+        return 0;
+    }
+    processor_decode(p);
+
+    //evict the least recently used image nobody holds
+    pthread_mutex_lock(&s->lock);
+    server_image *slot = 0;
+    for(server_image *im = s->images; im < s->images + s->image_count; im++) {
+        if(im->users) continue;
+        if(!im->p) {
+            slot = im;
+            break;
+        }
+        if(!slot || im->used < slot->used) slot = im;
+    }
+    if(slot->p) {
+        processor_free(slot->p);
+        free(slot->source);
+    }
+    *slot = (server_image){ .hash = hash, .p = p, .source = malloc(size), .size = size, .users = 1, .used = ++s->requests };
+    memcpy(slot->source, source, size);
+    pthread_mutex_unlock(&s->lock);
+    return slot;
+}
+
+void server_release(server *s, server_image *im) {
+    if(!im) return;
+    pthread_mutex_lock(&s->lock);
+    im->users--;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void server_push(int16_t **values, int *cap, int at, int16_t v) {
+    if(at == *cap) {
+        *cap *= 2;
+        *values = realloc(*values, *cap * sizeof(int16_t));
+    }
+    (*values)[at] = v;
+}
+
+//comma separated values, returns the count
+int server_values(int16_t **values, int *cap, char *list) {
+    char *end;
+    int count = 0;
+    while(*list) {
+        long v = strtol(list, &end, 0);
+        if(end == list) break;
+        server_push(values, cap, count++, v);
+        list = *end == ',' ? end + 1 : end;
+    }
+    return count;
+}
+
+//answers one request line, returns -1 if the connection has to be dropped
+int server_request(server_worker *w, char *line, FILE *in, FILE *out) {
+    char *program = 0, *hash = 0, *args = "", *input = "", *engine = "fast", *save;
+    int64_t budget = SERVER_BUDGET;
+    char *word = strtok_r(line, " \t\r\n", &save);
+    if(!word || strcmp(word, "run")) {
+        fprintf(out, "error expected run\n");
+        return 0;
+    }
+    while((word = strtok_r(0, " \t\r\n", &save))) {
+        char *value = strchr(word, '=');
+        if(!value) break;
+        *value++ = 0;
+        if(!strcmp(word, "program")) program = value;
+        else if(!strcmp(word, "hash")) hash = value;
+        else if(!strcmp(word, "args")) args = value;
+        else if(!strcmp(word, "input")) input = value;
+        else if(!strcmp(word, "budget")) budget = strtoll(value, 0, 0);
+        else if(!strcmp(word, "engine")) engine = value;
+        else break;
+    }
+    if(word) {
+        fprintf(out, "error unknown option %s\n", word);
+        return 0;
+    }
+
+    //the source follows the line, read it before anything can fail
+    char *source = 0;
+    size_t size = 0;
+    if(program) {
+        long n = atol(program);
+        if(n <= 0 || n > SERVER_MAX_PROGRAM) {
+            fprintf(out, "error program size must be 1..%d\n", SERVER_MAX_PROGRAM);
+            return -1;
+        }
+        size = n;
+        source = malloc(size);
+        if(fread(source, 1, size, in) != size) {
+            free(source);
+            return -1;
+        }
+    } else if(!hash) {
+        fprintf(out, "error expected program or hash\n");
+        return 0;
+    }
+
+    int kind = !strcmp(engine, "ref") ? ENGINE_REFERENCE : !strcmp(engine, "fast") ? ENGINE_FAST : !strcmp(engine, "jit") ? ENGINE_JIT : -1;
+    char *error = 0;
+    server_image *im = 0;
+    if(kind < 0) error = "engine must be ref, fast or jit";
+    else im = server_acquire(w->s, source ? server_hash(source, size) : strtoull(hash, 0, 16), source, size, &error);
+    free(source);
+    if(!im) {
+        fprintf(out, "error %s\n", error);
+        return 0;
+    }
+
+    //a clone of the same image only needs a reset
+    if(im == w->image) {
+        server_release(w->s, im);
+        processor_reset(w->p, im->p);
+    } else {
+        if(w->p) processor_free(w->p);
+        server_release(w->s, w->image);
+        w->image = im;
+        w->p = processor_clone(im->p);
+    }
+    processor *p = w->p;
+
+    int argn = server_values(&w->inputs, &w->input_cap, args);
+    for(int i = 0; i < argn && i < 3; i++) processor_set_register(p, i + 4, w->inputs[i]);
+    //the buffer is never 0, so an empty input reads zeros instead of prompting on stdin
+    int inputs = server_values(&w->inputs, &w->input_cap, input);
+    processor_set_inputs(p, w->inputs, inputs);
+    processor_set_engine(p, kind);
+
+    int stop, outputs = 0;
+    while(1) {
+        int64_t left = budget ? budget - processor_get_cycles(p) : 0;
+        if(budget && left <= 0) {
+            stop = STOP_BUDGET;
+            break;
+        }
+        stop = processor_run(p, left);
+        if(stop == STOP_OUTPUT) server_push(&w->outputs, &w->output_cap, outputs++, processor_read(p, DEVICE_CONSOLE_OUT));
+        else if(stop != STOP_BREAK && stop != STOP_WATCH) break;
+    }
+
+    fprintf(out, "%s cycles=%lld hash=%016llx", stop == STOP_HALT ? "halt" : stop == STOP_EXIT ? "exit" : "budget",
+        (long long)processor_get_cycles(p), (unsigned long long)im->hash);
+    if(stop == STOP_EXIT) fprintf(out, " exit=%d", processor_read(p, DEVICE_EXIT));
+    fprintf(out, " output=");
+    for(int i = 0; i < outputs; i++) fprintf(out, i ? ",%d" : "%d", w->outputs[i]);
+    fprintf(out, "\n");
+    return 0;
+}
+
+void *server_run_worker(void *arg) {
+    server_worker *w = arg;
+    char *line = 0;
+    size_t cap = 0;
+    while(1) {
+        int fd = accept(w->s->fd, 0, 0);
+        if(fd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        FILE *in = fdopen(fd, "r"), *out = fdopen(dup(fd), "w");
+        while(getline(&line, &cap, in) > 0) {
+            if(server_request(w, line, in, out) < 0) break;
+            if(fflush(out)) break;
+        }
+        fclose(in);
+        fclose(out);
+    }
+    free(line);
+    return 0;
 }
-#pragma endregion
 
-//INTERPRETER
-#pragma region
+int server_run(char *path, int worker_count) {
+    server s = { 0 };
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    s.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if(s.fd < 0 || bind(s.fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(s.fd, 64) < 0) {
+        printf("Cannot listen on %s\n", path);
+        return -1;
+    }
+    //a client hanging up mid response must not take the daemon down
+    signal(SIGPIPE, SIG_IGN);
 
-void interpret_control(processor *p, int16_t opcode, int *mem_read, int16_t *ALU_op, int *use_imm, int *use_rd, int *reg_write) {
-    switch(opcode) {
-        case 0:  *mem_read = 0; *ALU_op = 0; *use_imm = 0; *use_rd = 0; *reg_write = 1; break;
-        case 1:  *mem_read = 0; *ALU_op = 0; *use_imm = 1; *use_rd = 0; *reg_write = 1; break;
-        case 2:  *mem_read = 0; *ALU_op = 0; *use_imm = 1; *use_rd = 1; *reg_write = 1; break;
-        case 3:  *mem_read = 0; *ALU_op = 1; *use_imm = 0; *use_rd = 0; *reg_write = 1; break;
-        case 4:  *mem_read = 0; *ALU_op = 2; *use_imm = 0; *use_rd = 0; *reg_write = 1; break;
-        case 5:  *mem_read = 0; *ALU_op = 3; *use_imm = 0; *use_rd = 0; *reg_write = 1; break;
-        case 6:  *mem_read = 0; *ALU_op = 4; *use_imm = 0; *use_rd = 0; *reg_write = 1; break;
-        case 7:  *mem_read = 0; *ALU_op = 5; *use_imm = 0; *use_rd = 0; *reg_write = 1; break;
-        case 8:  *mem_read = 1; *ALU_op = 0; *use_imm = 1; *use_rd = 0; *reg_write = 1; break;
-        case 9:  *mem_read = 0; *ALU_op = 0; *use_imm = 1; *use_rd = 0; *reg_write = 0; break;
-        case 10: *mem_read = 0; *ALU_op = 8; *use_imm = 1; *use_rd = 1; *reg_write = 1; break;
-        case 11: *mem_read = 0; *ALU_op = 9; *use_imm = 1; *use_rd = 1; *reg_write = 1; break;
-        case 12: *mem_read = 0; *ALU_op = 6; *use_imm = 0; *use_rd = 0; *reg_write = 1; break;
-        case 13: *mem_read = 0; *ALU_op = 7; *use_imm = 0; *use_rd = 0; *reg_write = 1; break;
-        case 14: *mem_read = 0; *ALU_op = 8; *use_imm = 1; *use_rd = 1; *reg_write = 0; break;
-        case 15: *mem_read = 0; *ALU_op = 0; *use_imm = 1; *use_rd = 0; *reg_write = 1; break;
+    if(worker_count < 1) worker_count = 1;
+    //every worker holds at most one image and acquires one more, so a free slot always exists
+    s.image_count = worker_count * 2 + 1 > SERVER_MIN_IMAGES ? worker_count * 2 + 1 : SERVER_MIN_IMAGES;
+    s.images = calloc(s.image_count, sizeof(server_image));
+    pthread_mutex_init(&s.lock, 0);
+    server_worker *workers = calloc(worker_count, sizeof(server_worker));
+    printf("listening on %s with %d workers\n", path, worker_count);
+    fflush(stdout);
+    for(int i = 0; i < worker_count; i++) {
+        workers[i].s = &s;
+        workers[i].inputs = malloc(64 * sizeof(int16_t));
+        workers[i].outputs = malloc(64 * sizeof(int16_t));
+        workers[i].input_cap = workers[i].output_cap = 64;
+        pthread_create(&workers[i].thread, 0, server_run_worker, workers + i);
     }
+    for(int i = 0; i < worker_count; i++) pthread_join(workers[i].thread, 0);
+    close(s.fd);
+    unlink(path);
+    return 0;
 }
 
-void interpret_reg_file(processor *p, int rs1, int rs2, int rd, int reg_write, int data, int16_t *rs1_out, int16_t *rs2_out, int16_t *rd_out) {
-    *rs1_out = p->registers[rs1];
-    *rs2_out = p->registers[rs2];
-    *rd_out = p->registers[rd];
+#pragma endregion
 
-    if(reg_write && rd > 1) {
-        p->registers[rd] = data;
+//DEBUGGER
+#pragma region
+
+/*
+-g runs the program under an interactive debugger that can also go backwards. Running forward uses
+the fast engine, or the JIT with -j, and takes a full checkpoint of registers and memory every
+interval cycles. Single steps are recorded in an undo log of what each instruction overwrote: the
+register it wrote, the word an sw stored, or every word a device access changed. A reverse step pops
+the log; going back past its start restores the checkpoint below the target and replays forward
+from it, so any cycle is reached in time proportional to the interval, not to the length of the
+run. Once DEBUGGER_CHECKPOINTS are held, every other one is dropped and the interval doubles.
+
+Replays have to see what the first run saw: console inputs are kept by cycle and handed out again,
+and outputs and debug messages are only printed the first time their cycle is reached.
+
+Commands, an empty line repeats the last one:
+s [n]         step n instructions
+rs [n]        step n instructions backwards
+c             continue to the next pause, watchpoint hit or the end
+rc            continue backwards to the previous pause or watchpoint hit, or to cycle 0
+g <cycle>     go to a cycle, forwards or backwards
+b <pc>        pause at a pc or label
+d <pc>        delete the breakpoints at a pc or label
+w <addr> [n] [rwc]  watch n words for reads, writes or changes, writes by default
+dw <addr>     delete the watchpoints starting at a word address
+r             registers
+m <addr> [n]  n memory words from a word address
+q             quit
+*/
+
+#define DEBUGGER_INTERVAL (1 << 16)
+#define DEBUGGER_CHECKPOINTS 256    //even, thinning keeps half
+#define DEBUGGER_LOG (1 << 16)      //undo entries kept, the oldest half goes when it is full
+
+//undoes one instruction
+typedef struct undo {
+    uint16_t pc;
+    uint8_t reg;                //register written, 0 for none
+    uint8_t stored;             //an sw overwrote old_word at addr
+    int16_t old;                //value of reg before
+    uint16_t addr;
+    int16_t old_word;
+    uint16_t *words;            //device accesses: count, then address and old value pairs
+} undo;
+
+typedef struct checkpoint {
+    uint16_t PC;
+    int16_t registers[16];
+    int16_t *memory;
+} checkpoint;
+
+typedef struct debugger_input {
+    int64_t cycle;
+    int16_t value;
+} debugger_input;
+
+struct debugger {
+    processor *p;
+    checkpoint *checkpoints;    //checkpoint i holds the state at cycle i * interval
+    int checkpoint_count;
+    int64_t interval;
+    undo *log;                  //log[i] undoes the instruction run at cycle log_start + i
+    int log_count;
+    int64_t log_start;
+    int16_t *before;            //memory before a device access, to find what it changed
+    debugger_input *inputs;     //console inputs in cycle order
+    int input_count, input_cap;
+    int64_t seen;               //furthest cycle reached, what ran before it has been printed
+    int64_t end;                //cycle the program halted or exited at, -1 until it does
+    int end_stop;               //STOP_HALT, STOP_OUTPUT or STOP_EXIT
+};
+
+//console input device: a replay gets the value read at the same cycle the first time
+int16_t debugger_read_input(processor *p, uint16_t a) {
+    debugger *g = p->debug;
+    int lo = 0, hi = g->input_count;
+    while(lo < hi) {
+        int mid = (lo + hi) / 2;
+        if(g->inputs[mid].cycle < p->cycle) lo = mid + 1;
+        else hi = mid;
     }
-}
+    if(lo < g->input_count && g->inputs[lo].cycle == p->cycle) return g->inputs[lo].value;
 
-void interpret_imm_gen(processor *p, uint16_t instr, int16_t *imm) {
-    switch(bits(15, 12)) {
-        case 1:  
-        case 8:  
-        case 9:  
-        case 15: *imm = (bits(3, 0) << 28 >> 28); break; //the shifting is to make the value signed
-        case 2:  
-        case 10: 
-        case 11: 
-        case 14: *imm = (bits(7, 0) << 24 >> 24); break; //the shifting is to make the value signed
+    int16_t value = processor_input(p);
+    //the rest of the line is not a command
+    int c;
+    if(!p->inputs) while((c = getchar()) != '\n' && c != EOF);
+    if(g->input_count == g->input_cap) {
+        g->input_cap = g->input_cap ? g->input_cap * 2 : 16;
+        g->inputs = realloc(g->inputs, g->input_cap * sizeof(debugger_input));
     }
+    //new inputs are only read past every earlier one
+    g->inputs[g->input_count++] = (debugger_input){ p->cycle, value };
+    return value;
 }
 
-void interpret_ALU(processor *p, int ALU_op, int16_t A, int16_t B, int16_t *ALU_out) {
-    switch (ALU_op) {
-        case 0: *ALU_out = A + B;    break;
-        case 1: *ALU_out = A - B;    break;
-        case 2: *ALU_out = A << B;   break;
-        case 3: *ALU_out = A & B;    break;
-        case 4: *ALU_out = A | B;    break;
-        case 5: *ALU_out = A ^ B;    break;
-        case 6: *ALU_out = (A == B); break;
-        case 7: *ALU_out = (A < B);  break;
-        case 8: *ALU_out = B;        break;
-        case 9: *ALU_out = (B << 8); break;
+void debugger_checkpoint(debugger *g) {
+    processor *p = g->p;
+    checkpoint *c = g->checkpoints + g->checkpoint_count++;
+    c->PC = p->PC;
+    memcpy(c->registers, p->registers, sizeof(c->registers));
+    c->memory = malloc(MEMORY_SIZE);
+    memcpy(c->memory, p->memory, MEMORY_SIZE);
+    if(g->checkpoint_count < DEBUGGER_CHECKPOINTS) return;
+    //the even ones are the checkpoints of the doubled interval
+    for(int i = 0; i < DEBUGGER_CHECKPOINTS; i++) {
+        if(i & 1) free(g->checkpoints[i].memory);
+        else g->checkpoints[i / 2] = g->checkpoints[i];
     }
+    g->checkpoint_count /= 2;
+    g->interval *= 2;
 }
 
-void interpret_memory(processor *p, int mem_read, int mem_write, int16_t addr, int16_t data, int16_t *mem_out) {
-    if(mem_read) {
-        *mem_out = ((int16_t*)p->memory)[(uint16_t)addr];
-    }
-    if(mem_write) {
-        ((int16_t*)p->memory)[(uint16_t)addr] = data;
-    }
+//drops the oldest count entries of the undo log
+void debugger_forget(debugger *g, int count) {
+    for(int i = 0; i < count; i++) free(g->log[i].words);
+    memmove(g->log, g->log + count, (g->log_count - count) * sizeof(undo));
+    g->log_count -= count;
+    g->log_start += count;
 }
 
-void interpret(processor *p, int debug) {
-    p->PC = 0;
-    p->registers[0] = 0;
-    p->registers[1] = -1;
-    p->registers[3] = 0x7FFF;
-    int next_bp = 0;
-    if(debug) printf("addr   | instruction\n");
-    void print_instruction(uint16_t instr);
-    int cycle = 0;
+//the log only undoes back from where the processor is, anything else moving it has to clear it
+void debugger_clear(debugger *g) {
+    debugger_forget(g, g->log_count);
+    g->log_start = g->p->cycle;
+}
 
-    while(1) {
+//copies memory back word by word, so decoded and compiled code only goes stale where it changed
+void debugger_restore_memory(processor *p, int16_t *from) {
+    int16_t *mem = (int16_t*)p->memory;
+    for(int page = 0; page < MEMORY_PAGES; page++) {
+        int16_t *a = mem + page * 128, *b = from + page * 128;
+        if(!memcmp(a, b, 256)) continue;
+        for(int i = 0; i < 128; i++) {
+            if(a[i] == b[i]) continue;
+            a[i] = b[i];
+            processor_stored(p, page * 128 + i);
+        }
+    }
+}
 
-        //program unit
-        uint16_t instr = *(uint16_t*)(p->memory + p->PC);
-        int bnz = (bits(15, 12) == 14);
-        int jal = (bits(15, 12) == 15);
+void debugger_restore(debugger *g, int i) {
+    processor *p = g->p;
+    checkpoint *c = g->checkpoints + i;
+    debugger_restore_memory(p, c->memory);
+    memcpy(p->registers, c->registers, sizeof(p->registers));
+    p->PC = c->PC;
+    p->cycle = i * g->interval;
+    debugger_clear(g);
+}
 
-        if(debug) {
-            printf("0x%04X | ", p->PC);
-            print_instruction(instr);
-            printf("\n", instr);
-        }
+//after running forward: prints what has not been printed, notes the end and takes checkpoints
+void debugger_progress(debugger *g, int stop) {
+    processor *p = g->p;
+    if(p->cycle > g->seen) {
+        if(stop == STOP_OUTPUT) printf("output: %i\n", processor_read(p, DEVICE_CONSOLE_OUT));
+        if(stop == STOP_EXIT) printf("exit: %i\n", processor_read(p, DEVICE_EXIT));
+        g->seen = p->cycle;
+    }
+    //an output ends the program, as it does outside the debugger
+    if(stop == STOP_HALT || stop == STOP_OUTPUT || stop == STOP_EXIT) {
+        g->end = p->cycle;
+        g->end_stop = stop;
+    }
+    //forward runs stop on every multiple of the interval, so none is skipped
+    if(p->cycle == g->checkpoint_count * g->interval) debugger_checkpoint(g);
+}
 
-        //control
-        int mem_read;
-        int16_t ALU_op;
-        int use_imm;
-        int use_rd;
-        int reg_write;
-        interpret_control(p, bits(15, 12), &mem_read, &ALU_op, &use_imm, &use_rd, &reg_write);
+//words the last device access changed, found through the pages it dirtied
+uint16_t *debugger_changes(debugger *g) {
+    processor *p = g->p;
+    int16_t *mem = (int16_t*)p->memory;
+    int count = 0;
+    for(int a = 0; a < 0x10000; a++)
+        if(p->dirty[a >> 7] && mem[a] != g->before[a]) count++;
+    uint16_t *words = malloc((1 + 2 * count) * sizeof(uint16_t)), *w = words + 1;
+    words[0] = count;
+    for(int a = 0; a < 0x10000; a++) {
+        if(!p->dirty[a >> 7] || mem[a] == g->before[a]) continue;
+        *w++ = a;
+        *w++ = g->before[a];
+    }
+    return words;
+}
 
-        //ImmGen
-        int16_t imm;
-        interpret_imm_gen(p, instr, &imm);
+//runs one instruction and logs what it overwrites
+int debugger_step(debugger *g) {
+    processor *p = g->p;
+    if(g->end >= 0 && p->cycle >= g->end) return g->end_stop;
+    int16_t *mem = (int16_t*)p->memory;
+    uint16_t instr = *(uint16_t*)(p->memory + p->PC);
+    int opcode = bits(15, 12), rd = bits(11, 8);
+    uint16_t a = p->registers[bits(7, 4)] + (bits(3, 0) << 28 >> 28);
 
-        //RegFile read
-        int16_t data;
-        int16_t rd_out = p->registers[bits(11, 8)];
-        int16_t rs1_out = p->registers[bits(7, 4)];
-        int16_t rs2_out = p->registers[bits(3, 0)];
+    undo u = { .pc = p->PC };
+    if(opcode != 9 && opcode != 14 && rd > 1) {
+        u.reg = rd;
+        u.old = p->registers[rd];
+    }
+    int device = (opcode == 8 || opcode == 9) && (p->io_pages[a >> 8] & PAGE_DEVICE);
+    if(device) {
+        memcpy(g->before, p->memory, MEMORY_SIZE);
+        memset(p->dirty, 0, sizeof(p->dirty));
+    } else if(opcode == 9) {
+        u.stored = 1;
+        u.addr = a;
+        u.old_word = mem[a];
+    }
 
-        interpret_reg_file(p, bits(7, 4), bits(3, 0), bits(11, 8), 0, data, &rs1_out, &rs2_out, &rd_out);
-        
-        //ALU
-        int16_t ALU_out;
-        int16_t A = use_rd ? rd_out : rs1_out;
-        int16_t B = use_imm ? imm : rs2_out;
-        interpret_ALU(p, ALU_op, A, B, &ALU_out);
+    if(g->log_count == DEBUGGER_LOG) debugger_forget(g, DEBUGGER_LOG / 2);
+    p->out = p->cycle >= g->seen ? stdout : 0;
+    int stop = processor_run(p, 1);
+    if(device) u.words = debugger_changes(g);
+    g->log[g->log_count++] = u;
+    debugger_progress(g, stop);
+    return stop;
+}
 
-        //Memory
-        int16_t mem_out;
-        int mem_write = !reg_write && !bnz;
-        
-        //IO
-        if(ALU_out == 0x400 && bits(15, 12) == 8) {
-            int i;
-            printf("input: ");
-            fscanf(stdin, "%i", &i);
-            ((int16_t*)p->memory)[0x400] = i;
+void debugger_undo(debugger *g) {
+    processor *p = g->p;
+    int16_t *mem = (int16_t*)p->memory;
+    undo *u = g->log + --g->log_count;
+    if(u->reg) p->registers[u->reg] = u->old;
+    if(u->stored) {
+        mem[u->addr] = u->old_word;
+        processor_stored(p, u->addr);
+    }
+    if(u->words) {
+        for(uint16_t *w = u->words + 1; w < u->words + 1 + 2 * u->words[0]; w += 2) {
+            mem[w[0]] = w[1];
+            processor_stored(p, w[0]);
         }
+        free(u->words);
+    }
+    p->PC = u->pc;
+    p->cycle--;
+}
 
-        interpret_memory(p, mem_read, mem_write, ALU_out, rd_out, &mem_out);
+//runs forward at full speed up to cycle target, pauses and watchpoints stop it if asked
+int debugger_run(debugger *g, int64_t target, int pauses) {
+    processor *p = g->p;
+    int64_t start = p->cycle;
+    while(p->cycle < target) {
+        if(g->end >= 0 && p->cycle >= g->end) return g->end_stop;
+        //processor_run passes the pause it starts on, runs split at checkpoints must not
+        if(pauses && p->cycle != start && processor_paused(p, p->PC)) return STOP_BREAK;
+        int64_t stop_at = (p->cycle / g->interval + 1) * g->interval;
+        //printing turns on exactly where the first run left off
+        if(p->cycle < g->seen && g->seen < stop_at) stop_at = g->seen;
+        if(target < stop_at) stop_at = target;
+        p->out = p->cycle >= g->seen ? stdout : 0;
+        int stop = processor_run(p, stop_at - p->cycle);
+        debugger_clear(g);
+        debugger_progress(g, stop);
+        if(stop == STOP_HALT || stop == STOP_OUTPUT || stop == STOP_EXIT) return stop;
+        if(pauses && (stop == STOP_BREAK || stop == STOP_WATCH)) return stop;
+    }
+    return STOP_BUDGET;
+}
+
+//goes back to an earlier cycle, with the cycles before it undoable by the log
+void debugger_back(debugger *g, int64_t target) {
+    processor *p = g->p;
+    if(target < g->log_start) {
+        debugger_restore(g, target / g->interval);
+        debugger_run(g, target - DEBUGGER_LOG / 2, 0);
+        while(p->cycle < target) debugger_step(g);
+    }
+    while(p->cycle > target) debugger_undo(g);
+}
 
-        if(ALU_out == 0x402 && bits(15, 12) == 9) {
-            printf("%i\n", ((int16_t*)p->memory)[0x402]);
-            printf("cycles: %i\n", cycle);
-            exit(0);
+void debugger_seek(debugger *g, int64_t target) {
+    processor *p = g->p;
+    if(target < 0) target = 0;
+    if(target < p->cycle) {
+        debugger_back(g, target);
+        return;
+    }
+    //a checkpoint between here and the target skips the way there
+    int64_t i = target / g->interval;
+    if(i < g->checkpoint_count && i * g->interval > p->cycle) debugger_restore(g, i);
+    debugger_run(g, target, 0);
+}
+
+//back to the last cycle before this one that sits on a pause or on an lw or sw hitting a
+//watchpoint, cycle 0 if there is none
+void debugger_reverse(debugger *g) {
+    processor *p = g->p;
+    int64_t hi = p->cycle;
+    //scan one checkpoint interval at a time, forward, keeping the last stop before hi
+    while(hi > 0) {
+        int i = (hi - 1) / g->interval;
+        debugger_restore(g, i);
+        int64_t found = processor_paused(p, p->PC) ? p->cycle : -1;
+        int stop;
+        //a watch stop is past the access, the cycle before it is on the lw or sw
+        while((stop = debugger_run(g, hi, 1)) == STOP_BREAK || stop == STOP_WATCH)
+            found = stop == STOP_WATCH ? p->cycle - 1 : p->cycle;
+        if(found >= 0) {
+            debugger_back(g, found);
+            return;
         }
-        
-        //muxes
-        int16_t mux2_out = mem_read ? mem_out : ALU_out;
-        int not_zero = (rd_out != 0);
-        int16_t and_value = bnz && not_zero;
+        hi = i * g->interval;
+    }
+    debugger_back(g, 0);
+}
 
-        int16_t add_in = and_value ? mux2_out : 2;
-        uint16_t add_out = add_in + p->PC;
+void debugger_where(debugger *g) {
+    void print_instruction(uint16_t instr);
+    processor *p = g->p;
+    printf("cycle %lld  0x%04X | ", (long long)p->cycle, p->PC);
+    print_instruction(*(uint16_t*)(p->memory + p->PC));
+    char *ends[] = { "halted", "output", "exited" };
+    if(g->end >= 0 && p->cycle == g->end) printf("  (%s)", ends[g->end_stop]);
+    else if(processor_paused(p, p->PC)) printf("  (pause)");
+    printf("\n");
+}
 
-        uint16_t next_PC = jal ? mux2_out : add_out;
-        data = jal ? add_out : mux2_out;
+//a pc or a label, -1 if it is neither
+int debugger_pc(processor *p, char *arg) {
+    label *l = processor_find_label(p, arg);
+    if(l) return l->pc;
+    char *end;
+    long pc = strtol(arg, &end, 0);
+    return *arg && !*end && pc >= 0 && pc <= UINT16_MAX && !(pc & 1) ? pc : -1;
+}
 
-        //RegFile write
-        interpret_reg_file(p, bits(7, 4), bits(3, 0), bits(11, 8), reg_write, data, &rs1_out, &rs2_out, &rd_out);
-        
-        // fprintf(fp, "sample_mux2_out[%i] = %i;\n", cycle - 1, mux2_out);
-        // fprintf(fp, "sample_not_zero[%i] = %i;\n\n", cycle - 1, not_zero);
-        
-        //debug stuff
-        cycle++;
+int debugger_main(processor *p, int engine) {
+    int sprintreg(char *buf, int n);
+    debugger *g = calloc(1, sizeof(debugger));
+    g->p = p;
+    g->checkpoints = malloc(DEBUGGER_CHECKPOINTS * sizeof(checkpoint));
+    g->interval = DEBUGGER_INTERVAL;
+    g->log = malloc(DEBUGGER_LOG * sizeof(undo));
+    g->before = malloc(MEMORY_SIZE);
+    g->end = -1;
+    p->debug = g;
+    processor_set_engine(p, engine);
+    for(device *d = p->devices; d < p->devices + p->device_count; d++)
+        if(d->base == DEVICE_CONSOLE_IN) d->read = debugger_read_input;
+    p->registers[0] = 0;
+    p->registers[1] = -1;
+    debugger_checkpoint(g);
+    debugger_where(g);
 
-        if(next_PC == p->PC) return;
-        p->PC = next_PC;
+    char line[256], last[256] = "";
+    while(printf("> "), fflush(stdout), fgets(line, sizeof(line), stdin)) {
+        char command[16] = "", arg[128] = "", arg2[128] = "";
+        if(sscanf(line, "%15s %127s %127s", command, arg, arg2) < 1) {
+            if(!*last) continue;
+            strcpy(line, last);
+            sscanf(line, "%15s %127s %127s", command, arg, arg2);
+        }
+        strcpy(last, line);
+        long long n = *arg ? strtoll(arg, 0, 0) : 1;
 
-        if(jal || bnz) {
-            for(int i = p->breakpoint_count - 1; i >= 0 && p->breakpoints[i].pc >= p->PC; i--)
-                next_bp = i;
-        }
-        if(p->PC == p->breakpoints[next_bp].pc) {
-            char *str = p->breakpoints[next_bp].debug_msg;
-            if(str) {
-                #define reg(n) p->registers[str[n + 1]]
-                switch (str[0]) {
-                    case 0:  printf(str + 1); break;
-                    case 1:  printf(str + 2, reg(0)); break;
-                    case 2:  printf(str + 3, reg(0), reg(1)); break;
-                    case 3:  printf(str + 5, reg(0), reg(1), reg(2)); break;
-                    case 4:  printf(str + 6, reg(0), reg(1), reg(2), reg(3)); break;
-                    case 5:  printf(str + 7, reg(0), reg(1), reg(2), reg(3), reg(4)); break;
-                    default: printf(str + 8, reg(0), reg(1), reg(2), reg(3), reg(4), reg(5)); break;
-                }
-                printf("\n");
-                #undef reg
+        if(!strcmp(command, "s")) {
+            for(long long i = 0; i < n; i++) {
+                if(g->end >= 0 && p->cycle >= g->end) break;
+                debugger_step(g);
             }
-            next_bp++;
+        } else if(!strcmp(command, "rs")) {
+            debugger_back(g, p->cycle > n ? p->cycle - n : 0);
+        } else if(!strcmp(command, "c")) {
+            if(debugger_run(g, INT64_MAX, 1) == STOP_WATCH) watch_report(p, stdout);
+        } else if(!strcmp(command, "rc")) {
+            debugger_reverse(g);
+        } else if(!strcmp(command, "g") && *arg) {
+            debugger_seek(g, n);
+        } else if((!strcmp(command, "b") || !strcmp(command, "d")) && *arg) {
+            int pc = debugger_pc(p, arg);
+            if(pc < 0) printf("No such pc: %s\n", arg);
+            else if(*command == 'b') processor_add_breakpoint(p, pc, 0);
+            else printf("%d deleted\n", processor_remove_breakpoints(p, pc));
+            //compiled blocks only end at the breakpoints there were when they were compiled
+            if(p->run_jit) jit_flush(p->run_jit);
+            continue;
+        } else if(!strcmp(command, "w") && *arg) {
+            char kinds[8] = "w";
+            long long count = 1;
+            sscanf(line, "%*s %*s %lli %7s", &count, kinds);
+            if(count < 1 || count > 0xFFFF || processor_add_watchpoint(p, n, count, watch_kinds(kinds), 0) < 0)
+                printf("Bad watchpoint\n");
+            continue;
+        } else if(!strcmp(command, "dw") && *arg) {
+            printf("%d deleted\n", processor_remove_watchpoints(p, n));
+            continue;
+        } else if(!strcmp(command, "r")) {
+            for(int i = 0; i < 16; i++) {
+                char name[4];
+                sprintreg(name, i);
+                printf("%3s %6i%s", name, p->registers[i], i % 4 == 3 ? "\n" : "   ");
+            }
+            continue;
+        } else if(!strcmp(command, "m") && *arg) {
+            uint16_t a = n;
+            long long count = *arg2 ? strtoll(arg2, 0, 0) : 1;
+            for(long long i = 0; i < count; i++, a++) printf("0x%04X  %i\n", a, processor_read(p, a));
+            continue;
+        } else if(!strcmp(command, "q")) {
+            break;
+        } else {
+            printf("Commands: s [n], rs [n], c, rc, g <cycle>, b <pc>, d <pc>, w <addr> [n] [rwc], dw <addr>, r, m <addr> [n], q\n");
+            continue;
         }
-        #undef rd
-        #undef rs1
-        #undef rs2
+        debugger_where(g);
     }
-}
 
+    for(int i = 0; i < g->checkpoint_count; i++) free(g->checkpoints[i].memory);
+    debugger_forget(g, g->log_count);
+    free(g->checkpoints);
+    free(g->log);
+    free(g->before);
+    free(g->inputs);
+    free(g);
+    p->debug = 0;
+    return 0;
+}
 
 #pragma endregion
 
 //PARSER
+
 #pragma region 
 void skip_whitespace(char *buf, int *index) {
     while(buf[*index] && strchr(" \t\r\n", buf[*index])) (*index)++;
@@ -427,17 +4901,16 @@ int parse_register(char *buf, int *index) {
 }
 
 int parse_pause(processor *p, char *buf) {
-    breakpoint bp = (breakpoint){ .debug_msg = 0, .pc = p->PC };
-    if(p->breakpoint_count > 3 && !((p->breakpoint_count - 1) & p->breakpoint_count))
-        p->breakpoints = realloc(p->breakpoints, p->breakpoint_count * 2 * sizeof(breakpoint));
-    p->breakpoints[p->breakpoint_count++] = bp;
+    processor_add_breakpoint(p, p->PC, 0);
+    return 0;
 }
-int parse_debug(processor *p, char *buf) {
-    int index = 0;
+//"format" and its registers, in the layout interpret_debug_msg takes; 0 on errors
+char *parse_debug_msg(char *buf, int *at) {
+    int index = *at;
     skip_whitespace(buf, &index);
     if(buf[index] != '"') {
         printf("Expected debug string on");
-        return -1;
+        return 0;
     }
     int start = ++index;
  
@@ -450,8 +4923,9 @@ int parse_debug(processor *p, char *buf) {
     }
 
     int len = index - start;
-    char *debug_msg = malloc(len + expected + 1);
+    char *debug_msg = malloc(len + expected + 2);
     memcpy(debug_msg + expected + 1, buf + start, len);
+    debug_msg[expected + 1 + len] = 0;
     debug_msg[0] = expected;
 
     index++;
@@ -460,13 +4934,47 @@ int parse_debug(processor *p, char *buf) {
         if((debug_msg[i + 1] = parse_register(buf, &index)) < 0) {
             printf("Error: Malformed register on");
             free(debug_msg);
-            return -1;
+            return 0;
         }
     }
-    breakpoint bp = (breakpoint){ .debug_msg = debug_msg, .pc = p->PC };
-    if(p->breakpoint_count > 3 && !((p->breakpoint_count - 1) & p->breakpoint_count))
-        p->breakpoints = realloc(p->breakpoints, p->breakpoint_count * 2 * sizeof(breakpoint));
-    p->breakpoints[p->breakpoint_count++] = bp;
+    *at = index;
+    return debug_msg;
+}
+
+int parse_debug(processor *p, char *buf) {
+    int index = 0;
+    char *debug_msg = parse_debug_msg(buf, &index);
+    if(!debug_msg) return -1;
+    processor_add_breakpoint(p, p->PC, debug_msg);
+    return 0;
+}
+
+//watch <r, w and c letters> <word address> [count] ["format" registers]
+int parse_watch(processor *p, char *buf) {
+    char letters[8], *end;
+    int index = 0, kinds = 0;
+    if(sscanf(buf, " %7[a-z]%n", letters, &index) != 1 || !(kinds = watch_kinds(letters))) {
+        printf("Error: Expected watch kinds r, w or c on");
+        return -1;
+    }
+    long addr = strtol(buf + index, &end, 0);
+    if(end == buf + index || addr < 0 || addr > 0xFFFF) {
+        printf("Error: Expected watch address on");
+        return -1;
+    }
+    index = end - buf;
+    long count = strtol(buf + index, &end, 0);
+    if(end == buf + index) count = 1;
+    index = end - buf;
+
+    char *debug_msg = 0;
+    skip_whitespace(buf, &index);
+    if(buf[index] == '"' && !(debug_msg = parse_debug_msg(buf, &index))) return -1;
+    if(count < 1 || count > 0xFFFF || processor_add_watchpoint(p, addr, count, kinds, debug_msg) < 0) {
+        printf("Error: Watch range outside memory on");
+        free(debug_msg);
+        return -1;
+    }
     return 0;
 }
 
@@ -476,23 +4984,13 @@ int parse_label(processor *p, char *buf) {
         printf("Error: Expected label definition on");
         return -1;
     }
-    //add label
     int len = strlen(id);
     char *copy = malloc(len + 1);
     memcpy(copy, id, len + 1);
-    if(p->label_count > 3 && !((p->label_count - 1) & p->label_count))
-        p->labels = realloc(p->labels, p->label_count * 2 * sizeof(label));
-    p->labels[p->label_count++] = (label){ .pc = p->PC, .name = copy };
-
-    //search label refs and apply updates
-    for(int i = 0; i < p->label_ref_count; i++) {
-        if(strcmp(p->label_refs[i].name, id)) continue;
-        uint16_t *instr = (uint16_t*)(p->memory + p->label_refs[i].pc);
-        int opcode = (*instr >> 12);
-        if(opcode == 14)
-            *(char*)instr = p->PC - p->label_refs[i].pc;
-        else
-            *(char*)instr = p->PC;
+    if(processor_add_label(p, p->PC, copy) < 0) {
+        printf("Error: Duplicate label %s on", id);
+        free(copy);
+        return -1;
     }
     return 0;
 }
@@ -533,21 +5031,11 @@ int parse_type_b(processor *p, int opcode, char *buf) {
         int len = strlen(id);
         char *copy = malloc(len + 1);
         memcpy(copy, id, len + 1);
-        char found = 0;
 
-        //add label ref
+        //the immediate is filled in by processor_resolve_labels
         if(p->label_ref_count > 3 && !((p->label_ref_count - 1) & p->label_ref_count))
             p->label_refs = realloc(p->label_refs, p->label_ref_count * 2 * sizeof(label));
         p->label_refs[p->label_ref_count++] = (label){ .pc = p->PC, .name = copy };
-        //search for label
-        for(int i = 0; i < p->label_count; i++) {
-            if(strcmp(p->labels[i].name, id)) continue;
-            if(opcode == 14)
-                imm = p->labels[i].pc - p->PC;
-            else
-                imm = p->labels[i].pc;
-            break;
-        }
     } else {
         printf("Error: Expected immediate or label after register on");
         return -1;
@@ -598,25 +5086,25 @@ int sprintreg(char *buf, int n) {
     return sprintf(buf, "x%d", n);
 }
 
-void print_instruction(uint16_t instr) {
+void fprint_instruction(FILE *fp, uint16_t instr) {
     char type = 0;
     switch ((instr >> 12) & 0xF) {
-        case 0:  printf("add "); type = 'A'; break;
-        case 1:  printf("adi "); type = 'C'; break;
-        case 2:  printf("inc "); type = 'B'; break;
-        case 3:  printf("sub "); type = 'A'; break;
-        case 4:  printf("shl "); type = 'A'; break;
-        case 5:  printf("and "); type = 'A'; break;
-        case 6:  printf("or  "); type = 'A'; break;
-        case 7:  printf("xor "); type = 'A'; break;
-        case 8:  printf("lw  "); type = 'C'; break;
-        case 9:  printf("sw  "); type = 'C'; break;
-        case 10: printf("li  "); type = 'B'; break;
-        case 11: printf("lui "); type = 'B'; break;
-        case 12: printf("eq  "); type = 'A'; break;
-        case 13: printf("lt  "); type = 'A'; break;
-        case 14: printf("bnz "); type = 'B'; break;
-        case 15: printf("jal "); type = 'C'; break;
+        case 0:  fprintf(fp, "add "); type = 'A'; break;
+        case 1:  fprintf(fp, "adi "); type = 'C'; break;
+        case 2:  fprintf(fp, "inc "); type = 'B'; break;
+        case 3:  fprintf(fp, "sub "); type = 'A'; break;
+        case 4:  fprintf(fp, "shl "); type = 'A'; break;
+        case 5:  fprintf(fp, "and "); type = 'A'; break;
+        case 6:  fprintf(fp, "or  "); type = 'A'; break;
+        case 7:  fprintf(fp, "xor "); type = 'A'; break;
+        case 8:  fprintf(fp, "lw  "); type = 'C'; break;
+        case 9:  fprintf(fp, "sw  "); type = 'C'; break;
+        case 10: fprintf(fp, "li  "); type = 'B'; break;
+        case 11: fprintf(fp, "lui "); type = 'B'; break;
+        case 12: fprintf(fp, "eq  "); type = 'A'; break;
+        case 13: fprintf(fp, "lt  "); type = 'A'; break;
+        case 14: fprintf(fp, "bnz "); type = 'B'; break;
+        case 15: fprintf(fp, "jal "); type = 'C'; break;
     }
     char arg1[4], arg2[4], arg3[4];
     switch (type) {
@@ -624,11 +5112,11 @@ void print_instruction(uint16_t instr) {
             sprintreg(arg1, bits(11, 8));
             sprintreg(arg2, bits(7, 4));
             sprintreg(arg3, bits(3, 0));
-            printf("%3s, %3s, %3s", arg1, arg2, arg3);
+            fprintf(fp, "%3s, %3s, %3s", arg1, arg2, arg3);
             break;
         case 'B':
             sprintreg(arg1, bits(11, 8));
-            printf("%3s, %8i", arg1, (bits(7, 0) << 24 >> 24));
+            fprintf(fp, "%3s, %8i", arg1, (bits(7, 0) << 24 >> 24));
             break;
         case 'C':
             sprintreg(arg1, bits(11, 8));
@@ -636,31 +5124,73 @@ void print_instruction(uint16_t instr) {
             int n = (bits(3, 0) << 28 >> 28);
             char buf[16];
             sprintf(buf, "%s%s%d", arg2, n < 0 ? "" : "+", n);
-            printf("%3s, %8s", arg1, buf);
+            fprintf(fp, "%3s, %8s", arg1, buf);
             break;
     }
 }
 
+void print_instruction(uint16_t instr) {
+    fprint_instruction(stdout, instr);
+}
+
 #pragma endregion
 
+#ifndef INTERPRET_LIBRARY
 int main(int argc, char **argv) {
     int flags = 0;
+    char *batch_spec = 0;
+    char *input_path = 0;
+    char *pipeline_mode = 0;
+    char *icache_spec = 0, *dcache_spec = 0;
+    char *predictor_spec = 0;
+    char *vcd_spec = 0;
+    int hart_count = 0;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
     if(argc == 1) {
-        printf("Usage: ./interpret <file> <args> <options>\n\n");
-        printf("File: a path to the assembly file\n");
+        printf("Usage: ./interpret <file> <args> <options>\n");
+        printf("       ./interpret -S <socket> [-n <workers>]  run as a daemon, see SERVER in interpret.c\n\n");
+        printf("File: a path to the assembly file, an object file made with -o, or a trace made with -t to print\n");
         printf("Args: up to 3 integers to be stored in a0-a2\n");
         printf("Options:\n");
         printf("  -r  display raw instructions\n");
         printf("  -m  display machine code\n");
         printf("  -x  create hex file\n");
+        printf("  -c  create C source file\n");
+        printf("  -o  create binary object file\n");
+        printf("  -b <spec>  batch run over argument tuples, from a file or a range lo..hi\n");
+        printf("  -n <count> worker threads for -b\n");
+        printf("  -v  run -b jobs in SIMD lockstep on one thread\n");
+        printf("  -H <count> run count harts sharing memory on their own threads, see HARTS in interpret.c\n");
         printf("  -d  debug mode\n");
+        printf("  -g  interactive debugger that can step and continue backwards, see DEBUGGER in interpret.c\n");
+        printf("  -T  time the run, prints cycles, seconds, MIPS, ns per cycle and peak RSS in KiB tab separated to stderr\n");
+        printf("  -O  optimize the program before running or printing it\n");
+        printf("  -f  fast mode (pre-decoded, ignored with -d)\n");
+        printf("  -j  fast mode with x86-64 JIT for hot blocks\n");
+        printf("  -p  profile: hot spots and functions, folded stacks to <file>.folded (ignores -f, -j)\n");
+        printf("  -P <forward|stall>  5 stage pipeline timing with or without forwarding (ignores -f, -j)\n");
+        printf("  -I <spec>  instruction cache model, e.g. size=512,assoc=2,line=16,replace=lru|fifo|random,penalty=10 (ignores -f, -j)\n");
+        printf("  -D <spec>  data cache model, as -I plus write=back|through (ignores -f, -j)\n");
+        printf("  -B <spec>  branch predictor static|bimodal|gshare[,bits=10][,ras=8][,penalty=2] (ignores -f, -j)\n");
+        printf("  -s  stream: input values from stdin, outputs one per line without stopping\n");
+        printf("  -i <file>  stream input from a file instead of stdin (implies -s)\n");
+        printf("  -w <signals>  VCD waveform of pc,instr,alu_op,alu_out,mem_out,mux2_out,not_zero,next_pc,regs or all to <file>.vcd (ignores -f, -j)\n");
+        printf("  -t  binary trace of the last %d instructions to <file>.trace (ignores -f, -j)\n", TRACE_RECORDS);
         return 0;
     }
+    if(!strcmp(argv[1], "-S")) {
+        if(argc != 3 && !(argc == 5 && !strcmp(argv[3], "-n"))) {
+            printf("Usage: ./interpret -S <socket> [-n <workers>]\n");
+            return -1;
+        }
+        return server_run(argv[2], argc == 5 ? atoi(argv[4]) : threads);
+    }
     FILE *fp = fopen(argv[1], "r");
     if(!fp) {
         printf("No such file: %s\n", argv[1]);
         return -1;
     }
+    if(trace_is(fp)) return trace_decode(fp, stdout);
     int i;
     int args[3];
     int argn = 0;
@@ -683,13 +5213,68 @@ int main(int argc, char **argv) {
             case 'm': flags |= 2; break;
             case 'x': flags |= 4; break;
             case 'd': flags |= 8; break;
+            case 'f': flags |= 16; break;
+            case 'j': flags |= 32; break;
+            case 'c': flags |= 64; break;
+            case 'v': flags |= 128; break;
+            case 'o': flags |= 256; break;
+            case 'p': flags |= 512; break;
+            case 't': flags |= 1024; break;
+            case 's': flags |= 2048; break;
+            case 'O': flags |= 4096; break;
+            case 'T': flags |= 8192; break;
+            case 'g': flags |= 16384; break;
+            case 'b':
+            case 'n':
+            case 'i':
+            case 'P':
+            case 'I':
+            case 'D':
+            case 'B':
+            case 'H':
+            case 'w':
+                if(i + 1 == argc) {
+                    printf("Option %s needs a value\n", argv[i]);
+                    return -1;
+                }
+                if(argv[i][1] == 'b') batch_spec = argv[++i];
+                else if(argv[i][1] == 'n') threads = atoi(argv[++i]);
+                else if(argv[i][1] == 'P') pipeline_mode = argv[++i];
+                else if(argv[i][1] == 'I') icache_spec = argv[++i];
+                else if(argv[i][1] == 'D') dcache_spec = argv[++i];
+                else if(argv[i][1] == 'B') predictor_spec = argv[++i];
+                else if(argv[i][1] == 'H') hart_count = atoi(argv[++i]);
+                else if(argv[i][1] == 'w') vcd_spec = argv[++i];
+                else {
+                    input_path = argv[++i];
+                    flags |= 2048;
+                }
+                break;
             default:
                 printf("Invalid option: %s\n", argv[i]);
                 return -1;
         }
     }
+    if(pipeline_mode && strcmp(pipeline_mode, "forward") && strcmp(pipeline_mode, "stall")) {
+        printf("Pipeline mode must be forward or stall\n");
+        return -1;
+    }
     processor *p = processor_new();
-    int errors = processor_load(p, fp);
+    if(icache_spec && !(p->icache = cache_new("I-cache", icache_spec, 0))) return -1;
+    if(dcache_spec && !(p->dcache = cache_new("D-cache", dcache_spec, 1))) return -1;
+    if(predictor_spec && !(p->bpred = predictor_new(predictor_spec))) return -1;
+    if(flags & 2048) {
+        stream *s = stream_open(input_path);
+        if(!s) {
+            printf("No such file: %s\n", input_path);
+            return -1;
+        }
+        setvbuf(stdout, 0, _IOFBF, 1 << 20);
+        processor_stream(p, s);
+    }
+    int errors = object_is(fp) ? processor_map_object(p, argv[1]) : processor_load(p, fp);
+    fclose(fp);
+    if(!errors && (flags & 4096)) processor_optimize(p, stderr);
 
     for(int i = 0; i < argn; i++) {
         p->registers[i + 4] = args[i];
@@ -731,7 +5316,154 @@ int main(int argc, char **argv) {
         }
         fclose(fout);
         printf("%s generated\n", name);
+    } else if(flags & 256) {
+        char *last = strrchr(argv[1], '.');
+        if(!last) last = argv[1] + strlen(argv[1]);
+        char name[100];
+        snprintf(name, 100, "%.*s.obj", last - argv[1], argv[1]);
+        if(!strcmp(name, argv[1])) {
+            printf("Refusing to overwrite %s\n", name);
+            return -1;
+        }
+        FILE *fout = fopen(name, "wb");
+        processor_save_object(p, fout);
+        fclose(fout);
+        printf("%s generated\n", name);
+    } else if(flags & 64) {
+        char *last = strrchr(argv[1], '.');
+        if(!last) last = argv[1] + strlen(argv[1]);
+        char name[100];
+        snprintf(name, 100, "%.*s.c", last - argv[1], argv[1]);
+        if(!strcmp(name, argv[1])) {
+            printf("Refusing to overwrite %s\n", name);
+            return -1;
+        }
+        FILE *fout = fopen(name, "w");
+        translate(p, fout, argv[1]);
+        fclose(fout);
+        printf("%s generated\n", name);
+    } else if(flags & 16384) {
+        return debugger_main(p, (flags & 32) ? ENGINE_JIT : ENGINE_FAST);
+    } else if(hart_count) {
+        return harts_run(p, hart_count, (flags & 32) ? ENGINE_JIT : (flags & 16) ? ENGINE_FAST : ENGINE_REFERENCE);
+    } else if(batch_spec) {
+        batch_job *jobs;
+        int count = batch_parse(batch_spec, &jobs);
+        if(count < 0) return -1;
+        if(flags & 128) lockstep_run(p, jobs, count);
+        else batch_run(p, jobs, count, threads, (flags & 32) ? 2 : (flags & 16) ? 1 : 0);
+        for(int i = 0; i < count; i++) {
+            for(int k = 0; k < jobs[i].argn; k++) printf(k ? " %i" : "%i", jobs[i].args[k]);
+            if(jobs[i].stop == STOP_OUTPUT) printf("\t%i", jobs[i].output);
+            else if(jobs[i].stop == STOP_EXIT) printf("\texit %i", jobs[i].output);
+            else printf("\t-");
+            printf("\t%lld\n", (long long)jobs[i].cycles);
+        }
+        free(jobs);
     } else {
-        interpret(p, (flags & 8) > 0);
+        int stop;
+        char vcd_name[100];
+        if(vcd_spec) {
+            //opened before the run, the waveform is written while it goes
+            char *last = strrchr(argv[1], '.');
+            if(!last) last = argv[1] + strlen(argv[1]);
+            snprintf(vcd_name, 100, "%.*s.vcd", (int)(last - argv[1]), argv[1]);
+            if(!strcmp(vcd_name, argv[1])) {
+                printf("Refusing to overwrite %s\n", vcd_name);
+                return -1;
+            }
+            if(!(p->vcd = vcd_new(vcd_spec, vcd_name))) return -1;
+        }
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if((flags & (512 | 1024)) || pipeline_mode || p->icache || p->dcache || p->bpred || p->vcd) {
+            if(flags & 512) p->prof = profile_new(p->PC);
+            if(flags & 1024) p->trace = trace_new();
+            if(pipeline_mode) p->pipe = pipeline_new(!strcmp(pipeline_mode, "forward"));
+            stop = interpret(p, (flags & 8) > 0);
+        } else if((flags & 32) && !(flags & 8)) {
+            jit *j = jit_new(p);
+            stop = interpret_fast(p, j);
+            jit_free(j);
+        } else if((flags & 16) && !(flags & 8)) {
+            stop = interpret_fast(p, 0);
+        } else {
+            stop = interpret(p, (flags & 8) > 0);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if(flags & 8192) {
+            double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            #ifdef __APPLE__
+            usage.ru_maxrss /= 1024; //bytes there, KiB on Linux
+            #endif
+            fprintf(stderr, "timing\t%lld\t%.6f\t%.2f\t%.3f\t%ld\n", (long long)p->cycle, seconds,
+                p->cycle / seconds * 1e-6, seconds * 1e9 / (p->cycle ? p->cycle : 1), (long)usage.ru_maxrss);
+        }
+        if(stop == STOP_OUTPUT) {
+            printf("%i\n", ((int16_t*)p->memory)[DEVICE_CONSOLE_OUT]);
+            printf("cycles: %lld\n", (long long)p->cycle);
+        } else if(p->stream) {
+            //stdout carries the program's output stream
+            fflush(stdout);
+            if(stop == STOP_EXIT) fprintf(stderr, "exit: %i\n", ((int16_t*)p->memory)[DEVICE_EXIT]);
+            if(stop == STOP_WATCH) watch_report(p, stderr);
+            fprintf(stderr, "cycles: %lld\n", (long long)p->cycle);
+            stream_close(p->stream);
+        } else if(stop == STOP_EXIT) {
+            printf("exit: %i\n", ((int16_t*)p->memory)[DEVICE_EXIT]);
+            printf("cycles: %lld\n", (long long)p->cycle);
+        } else if(stop == STOP_WATCH) {
+            watch_report(p, stdout);
+            printf("cycles: %lld\n", (long long)p->cycle);
+        }
+        if(p->prof) {
+            profile_report(p->prof, p, stdout);
+            char *last = strrchr(argv[1], '.');
+            if(!last) last = argv[1] + strlen(argv[1]);
+            char name[100];
+            snprintf(name, 100, "%.*s.folded", last - argv[1], argv[1]);
+            FILE *fout = fopen(name, "w");
+            profile_folded(p->prof, p, fout);
+            fclose(fout);
+            printf("%s generated\n", name);
+            profile_free(p->prof);
+        }
+        if(p->pipe) {
+            pipeline_report(p->pipe, p, p->stream ? stderr : stdout);
+            pipeline_free(p->pipe);
+        }
+        if(p->icache || p->dcache || p->bpred) {
+            FILE *fout = p->stream ? stderr : stdout;
+            int64_t estimate = p->cycle + cache_cost(p->icache) + cache_cost(p->dcache);
+            if(p->icache) cache_report(p->icache, fout);
+            if(p->dcache) cache_report(p->dcache, fout);
+            if(p->bpred) {
+                predictor_report(p->bpred, p, fout);
+                estimate += predictor_cost(p->bpred);
+                predictor_free(p->bpred);
+            }
+            fprintf(fout, "\nestimated cycles: %lld\n", (long long)estimate);
+            cache_free(p->icache);
+            cache_free(p->dcache);
+        }
+        if(p->trace) {
+            char *last = strrchr(argv[1], '.');
+            if(!last) last = argv[1] + strlen(argv[1]);
+            char name[100];
+            snprintf(name, 100, "%.*s.trace", last - argv[1], argv[1]);
+            FILE *fout = fopen(name, "wb");
+            trace_save(p->trace, fout);
+            fclose(fout);
+            printf("%s generated\n", name);
+            trace_free(p->trace);
+        }
+        if(p->vcd) {
+            vcd_close(p->vcd, p->cycle);
+            printf("%s generated\n", vcd_name);
+        }
+        if(stop == STOP_EXIT) return ((int16_t*)p->memory)[DEVICE_EXIT];
     }
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,90 @@
+#ifndef INTERPRET_H
+#define INTERPRET_H
+
+/*
+Library interface to the emulator. Build interpret.c with INTERPRET_LIBRARY defined to leave out
+main():
+
+    cc -O2 -c -DINTERPRET_LIBRARY interpret.c -o interpret.o && ar rcs libinterpret.a interpret.o
+    cc -O2 -shared -fPIC -DINTERPRET_LIBRARY interpret.c -o libinterpret.so -lpthread
+
+A processor holds one program and its machine state. Load it once, clone it per concurrent user,
+and reset clones back to the image between runs; a processor is not safe to share between threads.
+Nothing in here exits the process: load errors come back as counts, and runs come back with a stop
+reason. Devices are attached as in the CLI, so the console, timer, exit and block devices work.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef struct processor processor;
+
+//why a run stopped, STOP_NONE is a device write that lets it continue
+enum { STOP_NONE = -1, STOP_HALT, STOP_OUTPUT, STOP_EXIT, STOP_BREAK, STOP_BUDGET, STOP_WATCH };
+
+//engines processor_run can use; all of them count the same cycles
+enum { ENGINE_REFERENCE, ENGINE_FAST, ENGINE_JIT };
+
+processor *processor_new();
+//a processor to run the same program in; the program tables are shared, so free clones first
+processor *processor_clone(processor *p);
+//puts a clone back into the state of the image it was cloned from
+void processor_reset(processor *p, processor *image);
+void processor_free(processor *p);
+
+//assembly from fp, returns the number of errors, which are printed to stdout
+int processor_load(processor *p, FILE *fp);
+//assembly or an object file made with -o, -1 if it cannot be opened
+int processor_load_file(processor *p, char *path);
+//count machine code words at address 0
+void processor_load_image(processor *p, uint16_t *code, int count);
+
+//debug_msg 0 is a pause, which stops processor_run with STOP_BREAK
+void processor_add_breakpoint(processor *p, uint16_t pc, char *debug_msg);
+int processor_remove_breakpoints(processor *p, uint16_t pc);
+
+//what an lw or sw has to do to the watched words to hit a watchpoint; change compares with the value last seen
+enum { WATCH_READ = 1, WATCH_WRITE = 2, WATCH_CHANGE = 4 };
+//watches count words from addr, debug_msg is printed on a hit as for breakpoints, 0 stops with STOP_WATCH
+int processor_add_watchpoint(processor *p, uint16_t addr, uint16_t count, int kinds, char *debug_msg);
+//removes every watchpoint starting at addr, returns how many were removed
+int processor_remove_watchpoints(processor *p, uint16_t addr);
+//kinds of the last hit, with the word accessed and the pc of the lw or sw
+int processor_watch_hit(processor *p, uint16_t *addr, uint16_t *pc);
+
+void processor_set_engine(processor *p, int engine);
+//values handed out by the console input device, 0 prompts on stdin
+void processor_set_inputs(processor *p, int16_t *inputs, int count);
+//debug messages go to out, 0 drops them
+void processor_set_output(processor *p, FILE *out);
+
+/*
+Runs for at most max_cycles more cycles, 0 for no limit, and returns why it stopped:
+STOP_HALT    the instruction at the PC jumps to itself; running again halts again
+STOP_OUTPUT  an sw to the console output device, the value is at DEVICE_CONSOLE_OUT
+STOP_EXIT    an sw to the exit device, the value is at DEVICE_EXIT
+STOP_BREAK   the PC is on a pause; running again continues past it
+STOP_BUDGET  max_cycles ran out before the instruction at the PC
+STOP_WATCH   an lw or sw hit a watchpoint without a message, see processor_watch_hit
+After an I/O or watch stop the lw or sw has completed and the PC is past it, so the next run carries on.
+*/
+int processor_run(processor *p, int64_t max_cycles);
+
+int16_t processor_get_register(processor *p, int n);
+//x0 and x1 are fixed, writes to them are ignored
+void processor_set_register(processor *p, int n, int16_t value);
+uint16_t processor_get_pc(processor *p);
+void processor_set_pc(processor *p, uint16_t pc);
+int64_t processor_get_cycles(processor *p);
+//memory is word addressed, as lw and sw see it
+int16_t processor_read(processor *p, uint16_t addr);
+void processor_write(processor *p, uint16_t addr, int16_t value);
+
+#define DEVICE_CONSOLE_IN 0x400
+#define DEVICE_CONSOLE_OUT 0x402
+#define DEVICE_TIMER 0x404
+#define DEVICE_EXIT 0x406
+#define DEVICE_BLOCK 0x408
+#define DEVICE_HART 0x410
+
+#endif